@@ -0,0 +1,184 @@
+#define HEAP_NO_MAIN
+#include "../src/main.c"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+
+/**
+ * @file msgbuf_bench.c
+ * @brief Compares the lock-free message buffer with heap_alloc plus a locked queue.
+ *
+ * @details
+ * Producers allocate messages of 16 to 527 bytes, fill them and hand them to a single
+ * consumer, which reads and frees them. The baseline serializes heap_alloc/heap_free with
+ * a mutex and passes pointers through a mutex-protected queue; the message buffer needs
+ * neither the lock nor the queue. Threads waiting on a full or empty buffer yield the
+ * CPU, so runs with more threads than cores measure the buffers rather than the
+ * scheduler starving whichever thread could make progress.
+ *
+ *     cc -O2 -pthread bench/msgbuf_bench.c -o msgbuf_bench
+ *     ./msgbuf_bench [producers] [messages per producer]
+ */
+#define BENCH_BUFFER (1u << 20)
+#define BENCH_QUEUE 4096
+
+static struct heapmsgbuf_t msgbuf;
+
+static struct {
+    pthread_mutex_t lock;
+    struct heapinfo_t heap;
+    void *queue[BENCH_QUEUE];
+    uint32_t head;
+    uint32_t tail;
+} locked;
+
+static uint32_t producers = 1;
+static uint32_t messages = 1000000;
+static _Atomic uint32_t running;
+
+static uint32_t bench_size(uint32_t *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return 16 + ((*seed >> 16) & 511);
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *msgbuf_producer(void *arg) {
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    for (uint32_t i = 0; i < messages; i++) {
+        uint32_t size = bench_size(&seed);
+        void *msg;
+        while ((msg = heap_msgbuf_alloc(&msgbuf, size)) == NULL) {
+            sched_yield(); // Buffer full, wait for the consumer
+        }
+        memset(msg, (int)i, size);
+        heap_msgbuf_publish(&msgbuf, msg);
+    }
+    atomic_fetch_sub(&running, 1);
+    return NULL;
+}
+
+static uint64_t msgbuf_consume(void) {
+    uint64_t received = 0;
+    uint32_t size;
+    for (;;) {
+        void *msg = heap_msgbuf_next(&msgbuf, &size);
+        if (msg == NULL) {
+            if (atomic_load(&running) == 0 && (msg = heap_msgbuf_next(&msgbuf, &size)) == NULL) {
+                break;
+            }
+            if (msg == NULL) {
+                sched_yield();
+                continue;
+            }
+        }
+        (void)*(volatile uint8_t *)msg;
+        received++;
+        heap_msgbuf_free(&msgbuf, msg);
+    }
+    return received;
+}
+
+static void *locked_producer(void *arg) {
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    for (uint32_t i = 0; i < messages; i++) {
+        uint32_t size = bench_size(&seed);
+        void *msg = NULL;
+        for (;;) {
+            pthread_mutex_lock(&locked.lock);
+            if (locked.head - locked.tail < BENCH_QUEUE && (msg = heap_alloc(&locked.heap, size)) != NULL) {
+                break;
+            }
+            pthread_mutex_unlock(&locked.lock);
+            sched_yield(); // Queue or heap full, wait for the consumer
+        }
+        pthread_mutex_unlock(&locked.lock);
+        memset(msg, (int)i, size);
+        pthread_mutex_lock(&locked.lock);
+        locked.queue[locked.head++ % BENCH_QUEUE] = msg;
+        pthread_mutex_unlock(&locked.lock);
+    }
+    atomic_fetch_sub(&running, 1);
+    return NULL;
+}
+
+static uint64_t locked_consume(void) {
+    uint64_t received = 0;
+    for (;;) {
+        void *msg = NULL;
+        bool done = atomic_load(&running) == 0;
+        pthread_mutex_lock(&locked.lock);
+        if (locked.tail != locked.head) {
+            msg = locked.queue[locked.tail++ % BENCH_QUEUE];
+        }
+        pthread_mutex_unlock(&locked.lock);
+        if (msg == NULL) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        (void)*(volatile uint8_t *)msg;
+        received++;
+        pthread_mutex_lock(&locked.lock);
+        heap_free(&locked.heap, msg);
+        pthread_mutex_unlock(&locked.lock);
+    }
+    return received;
+}
+
+static void bench_run(const char *name, void *(*producer)(void *), uint64_t (*consume)(void)) {
+    pthread_t threads[64];
+    atomic_store(&running, producers);
+    double start = bench_now();
+    for (uint32_t i = 0; i < producers; i++) {
+        pthread_create(&threads[i], NULL, producer, (void *)(uintptr_t)(i + 1));
+    }
+    uint64_t received = consume();
+    for (uint32_t i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = bench_now() - start;
+    printf("%-22s %u producer(s): %llu messages, %.1f ns/message\n", name, producers,
+           (unsigned long long)received, elapsed * 1e9 / (double)received);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        producers = (uint32_t)strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+        messages = (uint32_t)strtoul(argv[2], NULL, 0);
+    }
+    if (producers == 0 || producers > 64) {
+        fprintf(stderr, "usage: %s [producers 1-64] [messages per producer]\n", argv[0]);
+        return 2;
+    }
+
+    void *memory = mmap(NULL, BENCH_BUFFER, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    if (heap_msgbuf_init(&msgbuf, memory, BENCH_BUFFER, producers > 1) != 0) {
+        fprintf(stderr, "heap_msgbuf_init failed\n");
+        return 1;
+    }
+    bench_run(producers > 1 ? "heap_msgbuf (MPSC)" : "heap_msgbuf (SPSC)", msgbuf_producer, msgbuf_consume);
+
+    pthread_mutex_init(&locked.lock, NULL);
+    heap_init(&locked.heap, memory, BENCH_BUFFER);
+    bench_run("heap_alloc + queue", locked_producer, locked_consume);
+    pthread_mutex_destroy(&locked.lock);
+
+    munmap(memory, BENCH_BUFFER);
+    return 0;
+}
@@ -1,9 +1,28 @@
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <linux/io_uring.h>
+#include <linux/memfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <string.h> 
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <malloc.h>
 
 
 /**
@@ -20,6 +39,47 @@
 #define ALIGNMENT 8
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
 
+/**
+ * @brief Optional workload-specific size classes.
+ *
+ * @details
+ * When HEAP_SIZE_CLASSES is defined (usually through the header generated by
+ * tools/sizeclass_tune.c, e.g. `cc -include sizeclasses.h main.c`), every
+ * request is rounded up to the smallest class that holds it. Freed chunks then
+ * come back in sizes the workload reuses, instead of leaving odd-sized splinters.
+ * Requests larger than the last class are only aligned.
+ */
+#ifdef HEAP_SIZE_CLASSES
+static const uint32_t heap_size_classes[] = { HEAP_SIZE_CLASSES };
+#define HEAP_SIZE_CLASS_COUNT (sizeof(heap_size_classes) / sizeof(heap_size_classes[0]))
+#endif
+
+/**
+ * @brief Rounds a request size to the size actually reserved for it.
+ *
+ * @param size The requested size in bytes.
+ * @return The aligned size, at least ALIGNMENT, rounded up to a size class if classes
+ *         are configured.
+ */
+static uint32_t heap_round_size(uint32_t size) {
+    size = size > 0 ? ALIGN(size) : ALIGNMENT; // Room for the link of heap_release()
+#ifdef HEAP_SIZE_CLASSES
+    uint32_t lo = 0, hi = HEAP_SIZE_CLASS_COUNT;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (heap_size_classes[mid] < size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < HEAP_SIZE_CLASS_COUNT) {
+        size = ALIGN(heap_size_classes[lo]);
+    }
+#endif
+    return size;
+}
+
 /**
  * @struct heapchunk_t
  * @brief Represents a chunk of memory in a heap.
@@ -34,15 +94,50 @@
  * @var heapchunk_t::inuse
  * Flag indicating whether the chunk is currently in use (1) or free (0).
  *
+ * @var heapchunk_t::flags
+ * Per-chunk attributes; the low bits hold the lifetime hint of an in-use chunk,
+ * HEAP_CHUNK_ZEROED marks a chunk whose data is known to be zero and HEAP_CHUNK_TIMED
+ * an in-use chunk whose lifetime is being measured. HEAP_CHUNK_NESTED marks an in-use
+ * chunk that starts with a heap of its own (a child heap or a tag span) and
+ * HEAP_CHUNK_EXTENT one a child heap grew by; neither counts as an allocation.
+ *
+ * @var heapchunk_t::sample
+ * Slot (plus one) of the lifetime sample tracking this chunk, or 0 if it is not sampled.
+ *
  * @var heapchunk_t::next
  * Pointer to the next chunk in the heap.
  */
 struct heapchunk_t {
     uint32_t size;
     uint8_t inuse;
+    uint8_t flags;
+    uint16_t sample;
     struct heapchunk_t *next;
 };
 
+/**
+ * @enum heap_hint_t
+ * @brief Expected lifetime of an allocation, see heap_alloc_hint().
+ *
+ * @details
+ * - HEAP_HINT_SHORT: request-scoped data, freed soon. Served from the low end of the heap.
+ * - HEAP_HINT_LONG: cache entries and other data that outlives many requests. Served from the high end.
+ * - HEAP_HINT_PERMANENT: never freed. Served from the very top, with HEAP_HINT_LONG blocks
+ *   placed below the lowest permanent one, so that freed long-lived blocks leave holes
+ *   that coalesce instead of being pinned between permanent ones.
+ */
+enum heap_hint_t {
+    HEAP_HINT_SHORT = 0,
+    HEAP_HINT_LONG = 1,
+    HEAP_HINT_PERMANENT = 2,
+};
+
+#define HEAP_CHUNK_HINT_MASK 0x03
+#define HEAP_CHUNK_ZEROED 0x04
+#define HEAP_CHUNK_TIMED 0x08
+#define HEAP_CHUNK_NESTED 0x10
+#define HEAP_CHUNK_EXTENT 0x20
+
 /**
  * @struct heapinfo_t
  * @brief Represents information about a heap.
@@ -55,196 +150,5052 @@ struct heapchunk_t {
  *
  * @var heapinfo_t::avail
  * Available memory in the heap.
+ *
+ * @var heapinfo_t::parent
+ * Heap this heap was carved from and grows into, or NULL (see heap_create_child()).
+ *
+ * @var heapinfo_t::extents
+ * Pointer to the most recent extent taken from the parent when the heap had to grow.
+ *
+ * @var heapinfo_t::deferred
+ * Blocks whose last reference was dropped by heap_release(), linked through their
+ * first word and freed by the heap's next operation (see heap_drain()).
  */
 struct heapinfo_t {
     struct heapchunk_t *start;
     uint32_t avail;
+    struct heapinfo_t *parent;
+    struct heapextent_t *extents;
+    void *_Atomic deferred;
 };
 
 /**
- * Allocates a block of memory from the heap.
+ * @struct heapextent_t
+ * @brief Header of a block a child heap took from its parent to grow.
  *
- * This function searches for a free chunk of memory in the heap that is large enough to satisfy the requested size.
- * If a suitable chunk is found, it is marked as in use, and if the chunk is significantly larger than the requested size,
- * it is split into two chunks. The first chunk is returned to the caller, and the second chunk remains in the heap as free space.
+ * @var heapextent_t::next
+ * Pointer to the previously taken extent.
+ */
+struct heapextent_t {
+    struct heapextent_t *next;
+};
+
+/**
+ * @brief Minimum size of an extent taken from the parent when a child heap grows.
+ */
+#define HEAP_CHILD_GROW 1024
+
+/**
+ * @brief Tells whether `next` starts right where `chunk` ends.
+ *
+ * Chunks of a heap that grew into its parent are not all contiguous, and only
+ * contiguous chunks may be coalesced.
+ */
+static inline bool heap_adjacent(struct heapchunk_t *chunk, struct heapchunk_t *next) {
+    return (uint8_t *)(chunk + 1) + chunk->size == (uint8_t *)next;
+}
+
+static struct heapchunk_t *heap_grow(struct heapinfo_t *heap, uint32_t size);
+
+/**
+ * @brief Smallest free chunk worth zeroing ahead of time, in bytes.
+ *
+ * Smaller dirty chunks are only zeroed by heap_zero_idle() when they border a zeroed
+ * one, so that the two can coalesce.
+ */
+#define HEAP_ZERO_MIN 4096
+
+/**
+ * @brief Coalesces adjacent free chunks and recomputes the available memory.
+ *
+ * A zeroed chunk and a dirty neighbour are kept apart, so the work of heap_zero_idle()
+ * is not lost and no zeroing lands on the freeing thread, until heap_zero_idle() has
+ * cleared the neighbour too or `force` is set because an allocation found no chunk
+ * large enough.
  *
  * @param heap A pointer to the heap information structure.
- * @param size The size of the memory block to allocate, in bytes.
- * @return A pointer to the allocated memory block, or NULL if no suitable chunk is found.
+ * @param force Whether to join zeroed chunks with dirty neighbours as well.
+ * @return Whether any such pair was joined.
  */
-void *heap_alloc(struct heapinfo_t *heap, uint32_t size) {
-    size = ALIGN(size);
+static bool heap_coalesce(struct heapinfo_t *heap, bool force) {
+    bool joined = false;
+    struct heapchunk_t *current = heap->start;
+    while (current != NULL) {
+        struct heapchunk_t *next = current->next;
+        if (current->inuse || next == NULL || next->inuse || !heap_adjacent(current, next)) {
+            current = next;
+            continue;
+        }
+        bool zeroed = current->flags & next->flags & HEAP_CHUNK_ZEROED;
+        if ((current->flags ^ next->flags) & HEAP_CHUNK_ZEROED) {
+            if (!force) {
+                current = next;
+                continue;
+            }
+            joined = true;
+        }
+        current->size += sizeof(struct heapchunk_t) + next->size;
+        current->next = next->next;
+        if (zeroed) {
+            memset(next, 0, sizeof(struct heapchunk_t)); // The header becomes data
+            current->flags |= HEAP_CHUNK_ZEROED;
+        } else {
+            current->flags &= ~HEAP_CHUNK_ZEROED;
+        }
+        // The chunk may now touch another free chunk
+    }
+
+    heap->avail = 0;
+    for (current = heap->start; current != NULL; current = current->next) {
+        if (!current->inuse) {
+            heap->avail += current->size;
+        }
+    }
+    return joined;
+}
+
+/**
+ * @brief Slow-path events published to the telemetry ring, see heap_telemetry_open().
+ *
+ * @details
+ * - HEAP_EVENT_GROW: a child heap took an extent of `size` bytes at `addr` from its parent.
+ * - HEAP_EVENT_FAIL: an allocation of `size` bytes returned NULL to the caller.
+ * - HEAP_EVENT_TRIM: heap_trim() released `size` bytes.
+ */
+#define HEAP_EVENT_GROW 1
+#define HEAP_EVENT_FAIL 2
+#define HEAP_EVENT_TRIM 3
+
+static void heap_telemetry_event(uint32_t type, struct heapinfo_t *heap, uint64_t size, void *addr);
+
+/**
+ * @brief Takes `size` bytes from the low end of a free chunk.
+ *
+ * The chunk is marked as in use. If it is significantly larger than the requested size,
+ * the tail is split off as a new free chunk.
+ *
+ * @param chunk A free chunk of at least `size` bytes.
+ * @param size The aligned size to take.
+ * @return The chunk now in use.
+ */
+static struct heapchunk_t *heap_take_low(struct heapchunk_t *chunk, uint32_t size) {
+    chunk->inuse = true;
+    chunk->flags &= HEAP_CHUNK_ZEROED;
+    chunk->sample = 0;
+    if (chunk->size >= size + sizeof(struct heapchunk_t) + ALIGNMENT) {
+        struct heapchunk_t *new_chunk = (struct heapchunk_t *)((uint8_t *)chunk + sizeof(struct heapchunk_t) + size);
+        new_chunk->size = chunk->size - size - sizeof(struct heapchunk_t);
+        new_chunk->inuse = false;
+        new_chunk->flags = chunk->flags;
+        new_chunk->sample = 0;
+        new_chunk->next = chunk->next;
+        chunk->next = new_chunk;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+/**
+ * @brief Takes `size` bytes from the high end of a free chunk.
+ *
+ * If the chunk is significantly larger than the requested size, a new in-use chunk
+ * is split off its tail and the chunk itself stays free with the remaining space.
+ * Otherwise the whole chunk is marked as in use.
+ *
+ * @param chunk A free chunk of at least `size` bytes.
+ * @param size The aligned size to take.
+ * @return The chunk now in use.
+ */
+static struct heapchunk_t *heap_take_high(struct heapchunk_t *chunk, uint32_t size) {
+    if (chunk->size < size + sizeof(struct heapchunk_t) + ALIGNMENT) {
+        chunk->inuse = true;
+        chunk->flags &= HEAP_CHUNK_ZEROED;
+        chunk->sample = 0;
+        return chunk;
+    }
+    chunk->size -= size + sizeof(struct heapchunk_t);
+    struct heapchunk_t *new_chunk = (struct heapchunk_t *)((uint8_t *)(chunk + 1) + chunk->size);
+    new_chunk->size = size;
+    new_chunk->inuse = true;
+    new_chunk->flags = chunk->flags & HEAP_CHUNK_ZEROED;
+    new_chunk->sample = 0;
+    new_chunk->next = chunk->next;
+    chunk->next = new_chunk;
+    return new_chunk;
+}
+
+/**
+ * @brief Finds the first free chunk that fits and takes it from the low end.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param size The aligned size to allocate.
+ * @return The chunk now in use, or NULL if no suitable chunk is found.
+ */
+static struct heapchunk_t *heap_alloc_low(struct heapinfo_t *heap, uint32_t size) {
     struct heapchunk_t *chunk = heap->start;
     while (chunk != NULL) {
         if (!chunk->inuse && chunk->size >= size) {
-            chunk->inuse = true;
-            if (chunk->size >= size + sizeof(struct heapchunk_t) + ALIGNMENT) {
-                struct heapchunk_t *new_chunk = (struct heapchunk_t *)((uint8_t *)chunk + sizeof(struct heapchunk_t) + size);
-                new_chunk->size = chunk->size - size - sizeof(struct heapchunk_t);
-                new_chunk->inuse = false;
-                new_chunk->next = chunk->next;
-                chunk->next = new_chunk;
-                chunk->size = size;
-            }
-            return (void *)(chunk + 1);
+            return heap_take_low(chunk, size);
         }
         chunk = chunk->next;
     }
+    if (heap_coalesce(heap, true)) {
+        return heap_alloc_low(heap, size); // A zeroed chunk joined a dirty one
+    }
+    if (heap->parent != NULL && (chunk = heap_grow(heap, size)) != NULL) {
+        return heap_take_low(chunk, size);
+    }
     return NULL; // No suitable chunk found
 }
 
 /**
- * @brief Reallocates a memory block with a new size.
+ * @brief Grows a child heap with an extent taken from its parent.
  *
- * This function attempts to resize the memory block pointed to by `ptr` to 
- * `size` bytes. If `ptr` is NULL, it behaves like `malloc(size)`. If `size` 
- * is 0, it behaves like `free(ptr)` and returns NULL.
+ * The extent becomes a free chunk inserted in address order into the child's chunk list.
  *
- * @param ptr Pointer to the memory block to be reallocated. If NULL, a new 
- *            memory block is allocated.
- * @param size The new size of the memory block in bytes. If 0, the memory 
- *             block is freed.
- * @return A pointer to the newly allocated memory block, or NULL if the 
- *         allocation fails or if `size` is 0.
+ * @param heap A heap with a parent.
+ * @param size The aligned size the heap failed to allocate.
+ * @return The new free chunk, or NULL if the parent is exhausted.
  */
-void *heap_realloc(void *ptr, size_t size) {
-    if (ptr == NULL) {
-        return malloc(size);
-   }
-    if (size == 0) {
-        free(ptr);
-        return NULL;
-    }
-    size = ALIGN(size);
-    struct heapchunk_t *chunk = (struct heapchunk_t *)ptr - 1;
-    if (chunk->size >= size) {
-        return ptr;
-    }
-    void *new_ptr = malloc(size);
-    if (new_ptr == NULL) {
+static struct heapchunk_t *heap_grow(struct heapinfo_t *heap, uint32_t size) {
+    uint32_t need = ALIGN(sizeof(struct heapextent_t)) + sizeof(struct heapchunk_t) + size;
+    struct heapchunk_t *block = heap_alloc_low(heap->parent, need > HEAP_CHILD_GROW ? need : HEAP_CHILD_GROW);
+    if (block == NULL) {
         return NULL;
     }
+    block->flags |= HEAP_CHUNK_EXTENT;
+    struct heapextent_t *extent = (struct heapextent_t *)(block + 1);
+    extent->next = heap->extents;
+    heap->extents = extent;
 
-    memcpy(new_ptr, ptr, chunk->size);
-    free(ptr);
-    return new_ptr;
+    struct heapchunk_t *chunk = (struct heapchunk_t *)((uint8_t *)extent + ALIGN(sizeof(struct heapextent_t)));
+    chunk->size = block->size - ALIGN(sizeof(struct heapextent_t)) - sizeof(struct heapchunk_t);
+    chunk->inuse = false;
+    chunk->flags = 0;
+    chunk->sample = 0;
+    struct heapchunk_t **link = &heap->start;
+    while (*link != NULL && *link < chunk) {
+        link = &(*link)->next;
+    }
+    chunk->next = *link;
+    *link = chunk;
+    heap->avail += chunk->size;
+    heap_telemetry_event(HEAP_EVENT_GROW, heap, block->size, extent);
+    return chunk;
 }
 
 /**
- * @brief Allocates memory for an array of nmemb elements of size bytes each and initializes all bytes in the allocated storage to zero.
+ * @brief Finds the last free chunk that fits and takes it from the high end.
  *
- * This function is a custom implementation of calloc. It allocates memory for an array of nmemb elements, each of size bytes,
- * and initializes all bytes in the allocated memory to zero.
+ * Permanent blocks take the last fitting chunk of the heap. Long-lived blocks take the
+ * last fitting chunk below the lowest permanent block, so the permanent ones form a
+ * region of their own at the top; only when nothing below fits do they go above it.
+ * Long-lived blocks allocated before any permanent one hold the top until freed, and
+ * their holes are then reused by permanent blocks.
  *
- * @param nmemb Number of elements to allocate.
- * @param size Size of each element.
- * @return Pointer to the allocated memory, or NULL if the allocation fails.
+ * @param heap A pointer to the heap information structure.
+ * @param size The aligned size to allocate.
+ * @param hint The lifetime hint recorded in the chunk.
+ * @return The chunk now in use, or NULL if no suitable chunk is found.
  */
-void *heap_calloc(size_t nmemb, size_t size) {
-    size_t total_size = nmemb * size;
-    void *ptr = malloc(total_size);
-    if (ptr == NULL) {
+static struct heapchunk_t *heap_alloc_high(struct heapinfo_t *heap, uint32_t size, enum heap_hint_t hint) {
+    struct heapchunk_t *found = NULL;
+    struct heapchunk_t *above = NULL; // Last fit above a permanent block
+    bool permanent = false;
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        if (chunk->inuse) {
+            permanent |= hint == HEAP_HINT_LONG && (chunk->flags & HEAP_CHUNK_HINT_MASK) == HEAP_HINT_PERMANENT;
+        } else if (chunk->size >= size && permanent) {
+            above = chunk;
+        } else if (chunk->size >= size) {
+            found = chunk;
+        }
+    }
+    if (found == NULL) {
+        found = above;
+    }
+    if (found == NULL && heap_coalesce(heap, true)) {
+        return heap_alloc_high(heap, size, hint); // A zeroed chunk joined a dirty one
+    }
+    if (found == NULL && (heap->parent == NULL || (found = heap_grow(heap, size)) == NULL)) {
         return NULL;
     }
-    memset(ptr, 0, total_size);
-    return ptr;
+    struct heapchunk_t *chunk = heap_take_high(found, size);
+    chunk->flags |= (uint8_t)(hint & HEAP_CHUNK_HINT_MASK);
+    return chunk;
 }
 
 /**
- * Frees a previously allocated chunk of memory in the heap.
+ * @brief Lifetime prediction by allocation site.
  *
- * @param heap A pointer to the heap information structure.
- * @param ptr A pointer to the memory chunk to be freed. If NULL, the function does nothing.
+ * @details
+ * When enabled with heap_predict_enable(), heap_alloc() identifies its call site by
+ * return address and rounded size, and samples one allocation in HEAP_PREDICT_RATE.
+ * The lifetime of a sampled block is measured in allocations: the number of heap_alloc()
+ * calls between its allocation and its heap_free(). Each observation moves the site's
+ * score towards long (lifetime of at least HEAP_PREDICT_LONG) or short. Once a site has
+ * HEAP_PREDICT_MIN observations and a positive score, its allocations are placed like
+ * heap_alloc_hint(..., HEAP_HINT_LONG), without any change at the call site.
  *
- * This function marks the specified memory chunk as free. It does coalesce
- * adjacent free chunks. The available memory in the heap is updated accordingly.
+ * Samples that are still live when their slot is needed count as long-lived if they are
+ * older than HEAP_PREDICT_LONG, so sites that never free are learned as well.
+ *
+ * The site table is direct-mapped: two sites that hash to the same entry evict each other.
+ * Each thread learns in tables of its own, so threads allocating from their own heaps do
+ * not share any state; a sampled block freed by another thread is not observed.
  */
-void heap_free(struct heapinfo_t *heap, void *ptr) {
-    if (ptr == NULL) {
-        return;
-    }
-    struct heapchunk_t *chunk = (struct heapchunk_t *)ptr - 1;
-    chunk->inuse = false;
+#define HEAP_PREDICT_SITES 256
+#define HEAP_PREDICT_SAMPLES 64
+#define HEAP_PREDICT_RATE 16
+#define HEAP_PREDICT_LONG 4096
+#define HEAP_PREDICT_MIN 4
+#define HEAP_PREDICT_SCORE_MAX 8
 
-    struct heapchunk_t *current = heap->start;
-    while (current != NULL) {
-        if (!current->inuse && current->next != NULL && !current->next->inuse) {
-            current->size += sizeof(struct heapchunk_t) + current->next->size;
-            current->next = current->next->next;
+/**
+ * @struct heapsite_t
+ * @brief Learned lifetime of one allocation site.
+ *
+ * @var heapsite_t::key
+ * Return address combined with the rounded request size, 0 if the entry is unused.
+ *
+ * @var heapsite_t::observed
+ * Number of lifetimes observed for the site.
+ *
+ * @var heapsite_t::score
+ * Saturating vote, positive when the site's blocks tend to be long-lived.
+ */
+struct heapsite_t {
+    uint64_t key;
+    uint32_t observed;
+    int32_t score;
+};
+
+/**
+ * @struct heapsample_t
+ * @brief A sampled block whose lifetime is being measured.
+ *
+ * @var heapsample_t::ptr
+ * The sampled block, or NULL if the slot is free.
+ *
+ * @var heapsample_t::site
+ * Index of the block's site in the site table.
+ *
+ * @var heapsample_t::born
+ * Allocation clock when the block was allocated.
+ */
+struct heapsample_t {
+    void *ptr;
+    uint32_t site;
+    uint32_t born;
+};
+
+static _Atomic bool heap_predict_enabled;
+
+static _Thread_local struct {
+    uint32_t clock;
+    uint32_t countdown;
+    struct heapsite_t sites[HEAP_PREDICT_SITES];
+    struct heapsample_t samples[HEAP_PREDICT_SAMPLES];
+} heap_predict = {
+    .countdown = HEAP_PREDICT_RATE,
+};
+
+/**
+ * @brief Enables or disables lifetime prediction in heap_alloc().
+ *
+ * Disabling keeps what was learned; blocks that are still sampled are accounted when freed.
+ *
+ * @param enable true to enable prediction, false to disable it.
+ */
+void heap_predict_enable(bool enable) {
+    atomic_store_explicit(&heap_predict_enabled, enable, memory_order_relaxed);
+}
+
+static void heap_predict_observe(uint32_t site, uint32_t lifetime) {
+    struct heapsite_t *s = &heap_predict.sites[site];
+    s->observed++;
+    if (lifetime >= HEAP_PREDICT_LONG) {
+        if (s->score < HEAP_PREDICT_SCORE_MAX) {
+            s->score++;
         }
-        current = current->next;
+    } else if (s->score > -HEAP_PREDICT_SCORE_MAX) {
+        s->score--;
     }
+}
 
-    heap->avail = 0;
-    current = heap->start;
-    while (current != NULL) {
-        if (!current->inuse) {
-            heap->avail += current->size;
+/**
+ * @brief Starts measuring the lifetime of a freshly allocated chunk.
+ */
+static void heap_predict_sample(struct heapchunk_t *chunk, uint32_t site) {
+    uint32_t slot = 0, oldest = 0;
+    for (; slot < HEAP_PREDICT_SAMPLES; slot++) {
+        if (heap_predict.samples[slot].ptr == NULL) {
+            break;
+        }
+        if (heap_predict.clock - heap_predict.samples[slot].born >
+            heap_predict.clock - heap_predict.samples[oldest].born) {
+            oldest = slot;
+        }
+    }
+    if (slot == HEAP_PREDICT_SAMPLES) {
+        // Evict the oldest sample; it is only conclusive if it already lived long.
+        // The evicted chunk keeps a stale slot number, which heap_predict_free() ignores.
+        struct heapsample_t *old = &heap_predict.samples[oldest];
+        uint32_t age = heap_predict.clock - old->born;
+        if (age >= HEAP_PREDICT_LONG) {
+            heap_predict_observe(old->site, age);
         }
-        current = current->next;
+        slot = oldest;
     }
+    heap_predict.samples[slot].ptr = chunk + 1;
+    heap_predict.samples[slot].site = site;
+    heap_predict.samples[slot].born = heap_predict.clock;
+    chunk->sample = (uint16_t)(slot + 1);
 }
 
 /**
- * @brief Initializes a heap with the given start address and size.
+ * @brief Records the lifetime of a sampled chunk that is being freed.
+ */
+static void heap_predict_free(struct heapchunk_t *chunk) {
+    struct heapsample_t *sample = &heap_predict.samples[chunk->sample - 1];
+    if (sample->ptr == chunk + 1) {
+        heap_predict_observe(sample->site, heap_predict.clock - sample->born);
+        sample->ptr = NULL;
+    }
+    chunk->sample = 0;
+}
+
+/**
+ * @brief Allocates for a call site, placing it by the site's predicted lifetime.
+ */
+static struct heapchunk_t *heap_alloc_predicted(struct heapinfo_t *heap, uint32_t size, void *caller) {
+    uint64_t key = ((uint64_t)(uintptr_t)caller ^ ((uint64_t)size << 40)) | 1;
+    uint32_t site = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 56) & (HEAP_PREDICT_SITES - 1);
+    struct heapsite_t *s = &heap_predict.sites[site];
+    if (s->key != key) {
+        s->key = key;
+        s->observed = 0;
+        s->score = 0;
+    }
+    heap_predict.clock++;
+
+    struct heapchunk_t *chunk;
+    if (s->observed >= HEAP_PREDICT_MIN && s->score > 0) {
+        chunk = heap_alloc_high(heap, size, HEAP_HINT_LONG);
+    } else {
+        chunk = heap_alloc_low(heap, size);
+    }
+    if (chunk != NULL && --heap_predict.countdown == 0) {
+        heap_predict.countdown = HEAP_PREDICT_RATE;
+        heap_predict_sample(chunk, site);
+    }
+    return chunk;
+}
+
+/**
+ * @struct heaphooks_t
+ * @brief Callbacks run around heap operations, for accounting and tracing.
  *
- * This function sets up the initial heap structure by assigning the start address,
- * setting the size of the first chunk, marking it as not in use, and initializing
- * the available memory size.
+ * Any member may be NULL. `arg` is passed as the last argument of every callback. The
+ * allocation hooks also run for heap_alloc_hint(), heap_alloc_near() and heap_alloc_zeroed(),
+ * and once per call of heap_tag_alloc() and heap_tag_free(), against the tag's parent heap.
+ * Blocks the allocator takes from a heap for its own use, such as tag spans, child heaps
+ * and their extents, reach neither the allocation nor the free hooks.
  *
- * @param heap Pointer to the heapinfo_t structure to be initialized.
- * @param start Pointer to the start address of the heap memory.
- * @param size Total size of the heap memory in bytes.
+ * @var heaphooks_t::pre_alloc
+ * Called before an allocation with the requested size.
+ *
+ * @var heaphooks_t::post_alloc
+ * Called after an allocation with the requested size and the result, possibly NULL.
+ *
+ * @var heaphooks_t::pre_free
+ * Called before a block is freed.
+ *
+ * @var heaphooks_t::post_free
+ * Called after a block was freed; the pointer must not be dereferenced.
+ *
+ * @var heaphooks_t::pre_realloc
+ * Called before heap_realloc() with its arguments.
+ *
+ * @var heaphooks_t::post_realloc
+ * Called after heap_realloc() with its arguments and its result.
+ *
+ * @var heaphooks_t::arg
+ * Caller-defined context for the callbacks.
  */
-void heap_init(struct heapinfo_t *heap, void *start, const uint32_t size) {
-    heap->start = (struct heapchunk_t *)start;
-    heap->start->size = size - sizeof(struct heapchunk_t);
-    heap->start->inuse = false;
-    heap->start->next = NULL;
-    heap->avail = size - sizeof(struct heapchunk_t);
-}
+struct heaphooks_t {
+    void (*pre_alloc)(struct heapinfo_t *heap, uint32_t size, void *arg);
+    void (*post_alloc)(struct heapinfo_t *heap, uint32_t size, void *ptr, void *arg);
+    void (*pre_free)(struct heapinfo_t *heap, void *ptr, void *arg);
+    void (*post_free)(struct heapinfo_t *heap, void *ptr, void *arg);
+    void (*pre_realloc)(void *ptr, size_t size, void *arg);
+    void (*post_realloc)(void *ptr, size_t size, void *new_ptr, void *arg);
+    void *arg;
+};
+
+static const struct heaphooks_t *_Atomic heap_hooks;
 
 /**
- * @brief Returns the size of a previously allocated memory block.
+ * @brief Runs a hook if hooks are installed.
  *
- * This function retrieves the size of a memory block that was previously allocated
- * from the heap. The size is stored in the heapchunk_t structure that precedes the
- * memory block.
+ * With no hooks installed this costs one load and one predictable branch. Building with
+ * HEAP_NO_HOOKS removes the hooks from the operations entirely.
+ */
+#ifdef HEAP_NO_HOOKS
+#define HEAP_HOOK(name, ...) do { } while (0)
+#else
+#define HEAP_HOOK(name, ...)                                                                    \
+    do {                                                                                        \
+        const struct heaphooks_t *hooks_ = atomic_load_explicit(&heap_hooks, memory_order_acquire); \
+        if (__builtin_expect(hooks_ != NULL, 0) && hooks_->name != NULL) {                      \
+            hooks_->name(__VA_ARGS__, hooks_->arg);                                             \
+        }                                                                                       \
+    } while (0)
+#endif
+
+/**
+ * @brief Installs or removes the heap hooks.
  *
- * @param ptr A pointer to the allocated memory block.
- * @return The size of the allocated memory block in bytes, or 0 if the pointer is NULL.
+ * The structure is used in place and must stay valid while installed. Operations already
+ * running may still call the previous hooks.
+ *
+ * @param hooks The hooks to install, or NULL to remove them.
  */
-uint32_t heap_sizeof(void *ptr) {
-    if (ptr == NULL) {
-        return 0;
-    }
-    struct heapchunk_t *chunk = (struct heapchunk_t *)ptr - 1;
-    return chunk->size;
+void heap_set_hooks(const struct heaphooks_t *hooks) {
+    atomic_store_explicit(&heap_hooks, hooks, memory_order_release);
 }
 
 /**
- * @brief Prints information about the heap.
+ * @brief Allocation statistics kept in per-thread shards.
  *
- * This function prints information about the heap, including the start address,
- * the available memory, and details about each chunk in the heap.
+ * @details
+ * Each thread counts its allocations and frees in a shard of its own, cache lines no
+ * other thread writes, so counting costs a few plain stores and no shared atomics. A
+ * per-shard sequence counter, odd while the owner updates, lets heap_stats() read each
+ * shard consistently and merge them. Shards outlive their threads: a thread that exits
+ * leaves its counts behind and its shard is handed to the next new thread. Building
+ * with HEAP_NO_STATS removes the counting.
+ */
+#define HEAP_SHARDS_PER_PAGE 64
+
+/**
+ * @brief Number of size classes the statistics are broken down by.
  *
- * @param heap Pointer to the heapinfo_t structure containing information about the heap.
+ * With HEAP_SIZE_CLASSES, one per configured class plus one for larger blocks. Otherwise
+ * one per power of two: class `k` holds blocks of 2^(k-1) + 1 to 2^k bytes.
  */
-char *heap_info(struct heapinfo_t *heap) {
-    static char buffer[1024];
-    char *ptr = buffer;
-    ptr += sprintf(ptr, "Heap start: %p\n", heap->start);
-    ptr += sprintf(ptr, "Available memory: %u bytes\n", heap->avail);
-    struct heapchunk_t *chunk = heap->start;
-    while (chunk != NULL) {
-        ptr += sprintf(ptr, "Chunk: %p, size: %u, inuse: %d\n", chunk, chunk->size, chunk->inuse);
-        chunk = chunk->next;
-    }
-    return buffer;
-}
+#ifdef HEAP_SIZE_CLASSES
+#define HEAP_STATS_CLASSES (HEAP_SIZE_CLASS_COUNT + 1)
+#else
+#define HEAP_STATS_CLASSES 33
+#endif
 
 /**
- * @brief Main function to demonstrate the heap allocator.
+ * @brief Returns the statistics class of a block of `size` usable bytes.
+ */
+static inline uint32_t heap_stats_class(uint32_t size) {
+#ifdef HEAP_SIZE_CLASSES
+    uint32_t lo = 0, hi = HEAP_SIZE_CLASS_COUNT;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (ALIGN(heap_size_classes[mid]) < size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+#else
+    return size > 1 ? 32 - (uint32_t)__builtin_clz(size - 1) : 0;
+#endif
+}
+
+/**
+ * @brief Returns the largest block size of a statistics class.
+ *
+ * @param index A class index below HEAP_STATS_CLASSES.
+ * @return The size in bytes, or UINT64_MAX for the class of blocks larger than every
+ *         configured size class.
+ */
+uint64_t heap_stats_class_size(uint32_t index) {
+#ifdef HEAP_SIZE_CLASSES
+    return index < HEAP_SIZE_CLASS_COUNT ? ALIGN(heap_size_classes[index]) : UINT64_MAX;
+#else
+    return (uint64_t)1 << index;
+#endif
+}
+
+/**
+ * @struct heapstats_t
+ * @brief Allocation counters, see heap_stats().
+ *
+ * @var heapstats_t::allocs
+ * Number of blocks allocated.
+ *
+ * @var heapstats_t::frees
+ * Number of blocks freed.
+ *
+ * @var heapstats_t::bytes_allocated
+ * Usable bytes of the blocks allocated, including growth by heap_expand().
+ *
+ * @var heapstats_t::bytes_freed
+ * Usable bytes of the blocks freed.
+ *
+ * @var heapstats_t::class_allocs
+ * Blocks allocated per statistics class, see heap_stats_class_size(). A block that
+ * heap_expand() moves to another class counts as freed from the old one and allocated
+ * in the new one.
+ *
+ * @var heapstats_t::class_frees
+ * Blocks freed per statistics class.
+ */
+struct heapstats_t {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes_allocated;
+    uint64_t bytes_freed;
+    uint64_t class_allocs[HEAP_STATS_CLASSES];
+    uint64_t class_frees[HEAP_STATS_CLASSES];
+};
+
+/**
+ * @brief Number of log-scale buckets of the lifetime histograms, see heap_lifetime_enable().
+ */
+#define HEAP_LIFETIME_BUCKETS 40
+
+/**
+ * @struct heaplifehist_t
+ * @brief One thread's lifetime histograms, per statistics class.
+ */
+struct heaplifehist_t {
+    _Atomic uint64_t sum_ns[HEAP_STATS_CLASSES];
+    _Atomic uint64_t counts[HEAP_STATS_CLASSES][HEAP_LIFETIME_BUCKETS];
+};
+
+/**
+ * @struct heapshard_t
+ * @brief One thread's counters, guarded by a sequence counter.
+ *
+ * @var heapshard_t::seq
+ * Odd while the owner is updating the counters.
+ *
+ * @var heapshard_t::owned
+ * Whether a live thread owns the shard; changed under heap_shards.lock.
+ *
+ * @var heapshard_t::lifetimes
+ * Lifetime histograms, allocated by the owner at its first sampled free.
+ *
+ * @var heapshard_t::next
+ * Pointer to the next shard; set before the shard is published and never changed, as
+ * shards are never freed.
+ */
+struct heapshard_t {
+    _Alignas(64) _Atomic uint32_t seq;
+    bool owned;
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    _Atomic uint64_t bytes_allocated;
+    _Atomic uint64_t bytes_freed;
+    _Atomic uint64_t class_allocs[HEAP_STATS_CLASSES];
+    _Atomic uint64_t class_frees[HEAP_STATS_CLASSES];
+    struct heaplifehist_t *_Atomic lifetimes;
+    struct heapshard_t *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_once_t once;
+    pthread_key_t key;
+    struct heapshard_t *_Atomic head;   // Pushed under lock, traversed without
+} heap_shards = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+#ifndef HEAP_NO_STATS
+static _Thread_local struct heapshard_t *heap_shard;
+
+static void heap_shard_release(void *arg) {
+    struct heapshard_t *shard = arg;
+    pthread_mutex_lock(&heap_shards.lock);
+    shard->owned = false;
+    pthread_mutex_unlock(&heap_shards.lock);
+}
+
+static void heap_shard_key(void) {
+    pthread_key_create(&heap_shards.key, heap_shard_release);
+}
+
+/**
+ * @brief Gives the calling thread a shard: a released one, or one from a new page.
+ *
+ * @return The shard, or NULL if no memory is left for one.
+ */
+static struct heapshard_t *heap_shard_claim(void) {
+    pthread_once(&heap_shards.once, heap_shard_key);
+    pthread_mutex_lock(&heap_shards.lock);
+    struct heapshard_t *shard = atomic_load_explicit(&heap_shards.head, memory_order_relaxed);
+    while (shard != NULL && shard->owned) {
+        shard = shard->next;
+    }
+    if (shard == NULL) {
+        struct heapshard_t *page = mmap(NULL, HEAP_SHARDS_PER_PAGE * sizeof(struct heapshard_t),
+                                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page != MAP_FAILED) {
+            struct heapshard_t *head = atomic_load_explicit(&heap_shards.head, memory_order_relaxed);
+            for (uint32_t i = 0; i < HEAP_SHARDS_PER_PAGE; i++) {
+                page[i].next = i + 1 < HEAP_SHARDS_PER_PAGE ? &page[i + 1] : head;
+            }
+            atomic_store_explicit(&heap_shards.head, page, memory_order_release);
+            shard = page;
+        }
+    }
+    if (shard != NULL) {
+        shard->owned = true;
+        pthread_setspecific(heap_shards.key, shard);
+    }
+    pthread_mutex_unlock(&heap_shards.lock);
+    heap_shard = shard;
+    return shard;
+}
+#endif
+
+static inline void heap_shard_add(_Atomic uint64_t *counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @brief Opens an update of the calling thread's shard.
+ *
+ * @return The shard, its sequence counter now odd, or NULL if statistics are off.
+ */
+static inline struct heapshard_t *heap_shard_begin(void) {
+#ifndef HEAP_NO_STATS
+    struct heapshard_t *shard = heap_shard;
+    if (__builtin_expect(shard == NULL, 0) && (shard = heap_shard_claim()) == NULL) {
+        return NULL;
+    }
+    uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return shard;
+#else
+    return NULL;
+#endif
+}
+
+static inline void heap_shard_end(struct heapshard_t *shard) {
+    uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * @brief Sampled allocation lifetimes.
+ *
+ * @details
+ * After heap_lifetime_enable(rate), each thread timestamps one allocation in `rate`.
+ * When such a block is freed, its lifetime goes into the freeing thread's histogram for
+ * the block's statistics class: bucket `b` counts lifetimes of 2^b to 2^(b+1) - 1 ns,
+ * and the last bucket every longer one too. heap_lifetimes() merges the histograms.
+ *
+ * Timestamps are kept in a table of HEAP_LIFETIME_SLOTS slots, probed from a hash of
+ * the chunk's address. A block discarded along with its heap is measured then; a block
+ * that is never freed keeps its slot until heap_init() reuses its memory. When the
+ * probed slots are all held, the sample is dropped and counted.
+ */
+#define HEAP_LIFETIME_SLOTS 8192
+#define HEAP_LIFETIME_PROBES 4
+
+/**
+ * @struct heaplifeslot_t
+ * @brief The timestamp of one sampled block.
+ *
+ * @var heaplifeslot_t::chunk
+ * The sampled chunk, or NULL if the slot is free.
+ *
+ * @var heaplifeslot_t::born
+ * CLOCK_MONOTONIC time of the allocation, in nanoseconds.
+ */
+struct heaplifeslot_t {
+    struct heapchunk_t *_Atomic chunk;
+    uint64_t born;
+};
+
+static struct {
+    _Atomic uint32_t rate;
+    _Atomic uint64_t dropped;
+    _Atomic uint32_t held;      // Slots in use, so heap_init() can skip the scan
+    struct heaplifeslot_t slots[HEAP_LIFETIME_SLOTS];
+} heap_lifetime;
+
+static _Thread_local uint32_t heap_lifetime_tick;
+
+static uint64_t heap_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Starts or stops sampling allocation lifetimes.
+ *
+ * Blocks sampled before sampling stops are still measured when freed.
+ *
+ * @param rate Sample one allocation in `rate` per thread, or 0 to stop sampling.
+ */
+void heap_lifetime_enable(uint32_t rate) {
+    atomic_store_explicit(&heap_lifetime.rate, rate, memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the `probe`-th slot a chunk's timestamp may be kept in.
+ */
+static inline struct heaplifeslot_t *heap_lifetime_slot(struct heapchunk_t *chunk, uint32_t probe) {
+    uint64_t hash = ((uint64_t)(uintptr_t)chunk >> 4) * 0x9E3779B97F4A7C15ull;
+    return &heap_lifetime.slots[((uint32_t)(hash >> 32) + probe) % HEAP_LIFETIME_SLOTS];
+}
+
+/**
+ * @brief Timestamps a newly allocated chunk, if one of the probed slots is free.
+ */
+static void heap_lifetime_sample(struct heapchunk_t *chunk) {
+    for (uint32_t i = 0; i < HEAP_LIFETIME_PROBES; i++) {
+        struct heaplifeslot_t *slot = heap_lifetime_slot(chunk, i);
+        struct heapchunk_t *expected = NULL;
+        if (atomic_load_explicit(&slot->chunk, memory_order_relaxed) == NULL &&
+            atomic_compare_exchange_strong_explicit(&slot->chunk, &expected, chunk,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&heap_lifetime.held, 1, memory_order_relaxed);
+            slot->born = heap_now_ns();
+            chunk->flags |= HEAP_CHUNK_TIMED;
+            return;
+        }
+    }
+    atomic_fetch_add_explicit(&heap_lifetime.dropped, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Finds and frees the slot of a timestamped chunk.
+ *
+ * @return The chunk's allocation time, or 0 if heap_init() already took the slot back.
+ */
+static uint64_t heap_lifetime_release(struct heapchunk_t *chunk) {
+    for (uint32_t i = 0; i < HEAP_LIFETIME_PROBES; i++) {
+        struct heaplifeslot_t *slot = heap_lifetime_slot(chunk, i);
+        if (atomic_load_explicit(&slot->chunk, memory_order_relaxed) == chunk) {
+            uint64_t born = slot->born;
+            atomic_store_explicit(&slot->chunk, NULL, memory_order_release);
+            atomic_fetch_sub_explicit(&heap_lifetime.held, 1, memory_order_relaxed);
+            return born;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes back the slots of timestamped chunks in memory a heap is re-initialized over.
+ *
+ * Those chunks are gone without being freed, so their lifetimes are not recorded.
+ */
+static void heap_lifetime_forget(void *start, uint32_t size) {
+    if (atomic_load_explicit(&heap_lifetime.held, memory_order_relaxed) == 0) {
+        return;
+    }
+    uint8_t *begin = start, *end = begin + size;
+    for (uint32_t i = 0; i < HEAP_LIFETIME_SLOTS; i++) {
+        struct heaplifeslot_t *slot = &heap_lifetime.slots[i];
+        struct heapchunk_t *chunk = atomic_load_explicit(&slot->chunk, memory_order_relaxed);
+        if ((uint8_t *)chunk >= begin && (uint8_t *)chunk < end &&
+            atomic_compare_exchange_strong_explicit(&slot->chunk, &chunk, NULL,
+                                                    memory_order_relaxed, memory_order_relaxed)) {
+            atomic_fetch_sub_explicit(&heap_lifetime.held, 1, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Adds the lifetime of a timestamped chunk being freed to the shard's histogram.
+ */
+static void heap_lifetime_record(struct heapshard_t *shard, struct heapchunk_t *chunk) {
+    uint64_t born = heap_lifetime_release(chunk);
+    if (born == 0) {
+        return;
+    }
+    uint64_t lifetime = heap_now_ns() - born;
+
+    struct heaplifehist_t *hist = atomic_load_explicit(&shard->lifetimes, memory_order_relaxed);
+    if (hist == NULL) {
+        hist = mmap(NULL, sizeof(*hist), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (hist == MAP_FAILED) {
+            return;
+        }
+        atomic_store_explicit(&shard->lifetimes, hist, memory_order_release);
+    }
+    uint32_t class = heap_stats_class(chunk->size);
+    uint32_t bucket = lifetime > 1 ? 63 - (uint32_t)__builtin_clzll(lifetime) : 0;
+    if (bucket >= HEAP_LIFETIME_BUCKETS) {
+        bucket = HEAP_LIFETIME_BUCKETS - 1;
+    }
+    heap_shard_add(&hist->sum_ns[class], lifetime);
+    heap_shard_add(&hist->counts[class][bucket], 1);
+}
+
+/**
+ * @brief Counts a newly allocated chunk, and samples its lifetime if it is its turn.
+ */
+static inline void heap_stats_alloc(struct heapchunk_t *chunk) {
+    struct heapshard_t *shard = heap_shard_begin();
+    if (shard != NULL) {
+        heap_shard_add(&shard->allocs, 1);
+        heap_shard_add(&shard->bytes_allocated, chunk->size);
+        heap_shard_add(&shard->class_allocs[heap_stats_class(chunk->size)], 1);
+        heap_shard_end(shard);
+        uint32_t rate = atomic_load_explicit(&heap_lifetime.rate, memory_order_relaxed);
+        if (__builtin_expect(rate != 0, 0) && ++heap_lifetime_tick >= rate) {
+            heap_lifetime_tick = 0;
+            heap_lifetime_sample(chunk);
+        }
+    }
+}
+
+/**
+ * @brief Counts a chunk being freed, and records its lifetime if it was sampled.
+ */
+static inline void heap_stats_free(struct heapchunk_t *chunk) {
+    struct heapshard_t *shard = heap_shard_begin();
+    if (shard != NULL) {
+        heap_shard_add(&shard->frees, 1);
+        heap_shard_add(&shard->bytes_freed, chunk->size);
+        heap_shard_add(&shard->class_frees[heap_stats_class(chunk->size)], 1);
+        if (__builtin_expect(chunk->flags & HEAP_CHUNK_TIMED, 0)) {
+            heap_lifetime_record(shard, chunk);
+        }
+        heap_shard_end(shard);
+    } else if (chunk->flags & HEAP_CHUNK_TIMED) {
+        heap_lifetime_release(chunk);
+    }
+}
+
+/**
+ * @brief Counts a block grown in place from `old_size` to `new_size` usable bytes.
+ */
+static inline void heap_stats_resize(uint32_t old_size, uint32_t new_size) {
+    struct heapshard_t *shard = heap_shard_begin();
+    if (shard != NULL) {
+        heap_shard_add(&shard->bytes_allocated, new_size - old_size);
+        uint32_t from = heap_stats_class(old_size), to = heap_stats_class(new_size);
+        if (from != to) {
+            heap_shard_add(&shard->class_frees[from], 1);
+            heap_shard_add(&shard->class_allocs[to], 1);
+        }
+        heap_shard_end(shard);
+    }
+}
+
+/**
+ * @brief Reads the allocation counters of all threads, past and present.
+ *
+ * Each shard is read consistently: a block is never counted as allocated without its
+ * bytes. Shards are read one after the other, so a block allocated by one thread and
+ * freed by another during the call may be seen freed but not allocated. Takes no lock.
+ *
+ * @param stats Receives the sums over all shards.
+ */
+void heap_stats(struct heapstats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    struct heapshard_t *shard = atomic_load_explicit(&heap_shards.head, memory_order_acquire);
+    for (; shard != NULL; shard = shard->next) {
+        struct heapstats_t s;
+        uint32_t seq;
+        do {
+            seq = atomic_load_explicit(&shard->seq, memory_order_acquire);
+            s.allocs = atomic_load_explicit(&shard->allocs, memory_order_relaxed);
+            s.frees = atomic_load_explicit(&shard->frees, memory_order_relaxed);
+            s.bytes_allocated = atomic_load_explicit(&shard->bytes_allocated, memory_order_relaxed);
+            s.bytes_freed = atomic_load_explicit(&shard->bytes_freed, memory_order_relaxed);
+            for (uint32_t i = 0; i < HEAP_STATS_CLASSES; i++) {
+                s.class_allocs[i] = atomic_load_explicit(&shard->class_allocs[i], memory_order_relaxed);
+                s.class_frees[i] = atomic_load_explicit(&shard->class_frees[i], memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+        } while ((seq & 1) != 0 || atomic_load_explicit(&shard->seq, memory_order_relaxed) != seq);
+        stats->allocs += s.allocs;
+        stats->frees += s.frees;
+        stats->bytes_allocated += s.bytes_allocated;
+        stats->bytes_freed += s.bytes_freed;
+        for (uint32_t i = 0; i < HEAP_STATS_CLASSES; i++) {
+            stats->class_allocs[i] += s.class_allocs[i];
+            stats->class_frees[i] += s.class_frees[i];
+        }
+    }
+}
+
+/**
+ * @struct heaplifetimes_t
+ * @brief Merged lifetime histograms, see heap_lifetimes().
+ *
+ * @var heaplifetimes_t::sampled
+ * Number of lifetimes recorded.
+ *
+ * @var heaplifetimes_t::dropped
+ * Number of samples skipped because every probed timestamp slot was held.
+ *
+ * @var heaplifetimes_t::sum_ns
+ * Sum of the lifetimes recorded per statistics class, in nanoseconds.
+ *
+ * @var heaplifetimes_t::counts
+ * Lifetimes per statistics class and log-scale bucket, see heap_lifetime_enable().
+ */
+struct heaplifetimes_t {
+    uint64_t sampled;
+    uint64_t dropped;
+    uint64_t sum_ns[HEAP_STATS_CLASSES];
+    uint64_t counts[HEAP_STATS_CLASSES][HEAP_LIFETIME_BUCKETS];
+};
+
+/**
+ * @brief Reads the lifetime histograms of all threads, past and present.
+ *
+ * Each thread's histograms are read consistently, as in heap_stats(). Takes no lock.
+ *
+ * @param lifetimes Receives the merged histograms.
+ */
+void heap_lifetimes(struct heaplifetimes_t *lifetimes) {
+    memset(lifetimes, 0, sizeof(*lifetimes));
+    lifetimes->dropped = atomic_load_explicit(&heap_lifetime.dropped, memory_order_relaxed);
+    struct heapshard_t *shard = atomic_load_explicit(&heap_shards.head, memory_order_acquire);
+    for (; shard != NULL; shard = shard->next) {
+        struct heaplifehist_t *hist = atomic_load_explicit(&shard->lifetimes, memory_order_acquire);
+        if (hist == NULL) {
+            continue;
+        }
+        struct heaplifetimes_t s;
+        uint32_t seq;
+        do {
+            seq = atomic_load_explicit(&shard->seq, memory_order_acquire);
+            for (uint32_t c = 0; c < HEAP_STATS_CLASSES; c++) {
+                s.sum_ns[c] = atomic_load_explicit(&hist->sum_ns[c], memory_order_relaxed);
+                for (uint32_t b = 0; b < HEAP_LIFETIME_BUCKETS; b++) {
+                    s.counts[c][b] = atomic_load_explicit(&hist->counts[c][b], memory_order_relaxed);
+                }
+            }
+            atomic_thread_fence(memory_order_acquire);
+        } while ((seq & 1) != 0 || atomic_load_explicit(&shard->seq, memory_order_relaxed) != seq);
+        for (uint32_t c = 0; c < HEAP_STATS_CLASSES; c++) {
+            lifetimes->sum_ns[c] += s.sum_ns[c];
+            for (uint32_t b = 0; b < HEAP_LIFETIME_BUCKETS; b++) {
+                lifetimes->counts[c][b] += s.counts[c][b];
+                lifetimes->sampled += s.counts[c][b];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Shared-memory telemetry for out-of-process monitoring.
+ *
+ * @details
+ * heap_telemetry_open() maps a shared region that an external tool can map read-only
+ * (see tools/telemetry_read.c) to watch the allocator live. The layout is fixed; all
+ * fields are native-endian and at the offsets given by the structures below:
+ *
+ * - A heaptelemetry_t header, starting with HEAP_TELEMETRY_MAGIC and
+ *   HEAP_TELEMETRY_VERSION. `header_size` gives the offset of the event ring,
+ *   `event_size` the size of each event and `capacity` their number, a power of two.
+ * - The counters of heap_stats(), guarded by `seq`: a reader copies them while `seq`
+ *   is even and unchanged before and after. They are refreshed at every event and by
+ *   heap_telemetry_publish(), so an application may also call that from a timer.
+ * - Slow-path totals (`grows`, `failures`, `trims`, `bytes_trimmed`), always current.
+ * - `head`, the number of events ever written. Event `i` lives in slot `i % capacity`
+ *   and is complete when the slot's `seq` equals `2 * i + 2`; it was overwritten if
+ *   `seq` is larger. A reader copies the event and checks `seq` again afterwards.
+ *
+ * Publishing takes no locks and, past each thread's first event, which looks up its
+ * thread id, makes no system calls: timestamps come from clock_gettime(CLOCK_MONOTONIC),
+ * served by the vDSO, slots are claimed with an atomic increment, and a counter refresh
+ * already in progress on another thread is skipped.
+ */
+#define HEAP_TELEMETRY_MAGIC 0x314f4c4c4159594dull  // "MYALLOC1"
+#define HEAP_TELEMETRY_VERSION 1
+#define HEAP_TELEMETRY_EVENTS 1024
+
+/**
+ * @struct heapevent_t
+ * @brief One slot of the telemetry event ring.
+ *
+ * @var heapevent_t::seq
+ * `2 * i + 2` once event `i` is complete, odd while it is written.
+ *
+ * @var heapevent_t::time_ns
+ * CLOCK_MONOTONIC time of the event, in nanoseconds.
+ *
+ * @var heapevent_t::type
+ * One of the HEAP_EVENT_* values.
+ *
+ * @var heapevent_t::tid
+ * Thread id of the thread that caused the event.
+ *
+ * @var heapevent_t::heap
+ * Address of the heap information structure.
+ *
+ * @var heapevent_t::size
+ * Size in bytes, depending on the event type.
+ *
+ * @var heapevent_t::addr
+ * Address, depending on the event type, or 0.
+ */
+struct heapevent_t {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t time_ns;
+    _Atomic uint32_t type;
+    _Atomic uint32_t tid;
+    _Atomic uint64_t heap;
+    _Atomic uint64_t size;
+    _Atomic uint64_t addr;
+};
+
+/**
+ * @struct heaptelemetry_t
+ * @brief Header of the shared telemetry region, followed by the event ring.
+ */
+struct heaptelemetry_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t event_size;
+    uint32_t capacity;
+    uint64_t pid;
+    _Alignas(64) _Atomic uint64_t seq;
+    _Atomic uint64_t time_ns;
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    _Atomic uint64_t bytes_allocated;
+    _Atomic uint64_t bytes_freed;
+    _Alignas(64) _Atomic uint64_t grows;
+    _Atomic uint64_t failures;
+    _Atomic uint64_t trims;
+    _Atomic uint64_t bytes_trimmed;
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) struct heapevent_t events[];
+};
+
+static struct {
+    struct heaptelemetry_t *_Atomic region;
+    atomic_flag publishing;
+    int fd;
+    char name[64];
+} heap_telemetry = {
+    .publishing = ATOMIC_FLAG_INIT,
+    .fd = -1,
+};
+
+static _Thread_local uint32_t heap_tid;
+
+/**
+ * @brief Copies the counters of heap_stats() into the telemetry region.
+ *
+ * Does nothing when telemetry is off or another thread is publishing already.
+ */
+void heap_telemetry_publish(void) {
+    struct heaptelemetry_t *region = atomic_load_explicit(&heap_telemetry.region, memory_order_acquire);
+    if (region == NULL || atomic_flag_test_and_set_explicit(&heap_telemetry.publishing, memory_order_acquire)) {
+        return;
+    }
+    struct heapstats_t stats;
+    heap_stats(&stats);
+    uint64_t seq = atomic_load_explicit(&region->seq, memory_order_relaxed);
+    atomic_store_explicit(&region->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&region->time_ns, heap_now_ns(), memory_order_relaxed);
+    atomic_store_explicit(&region->allocs, stats.allocs, memory_order_relaxed);
+    atomic_store_explicit(&region->frees, stats.frees, memory_order_relaxed);
+    atomic_store_explicit(&region->bytes_allocated, stats.bytes_allocated, memory_order_relaxed);
+    atomic_store_explicit(&region->bytes_freed, stats.bytes_freed, memory_order_relaxed);
+    atomic_store_explicit(&region->seq, seq + 2, memory_order_release);
+    atomic_flag_clear_explicit(&heap_telemetry.publishing, memory_order_release);
+}
+
+/**
+ * @brief Records a slow-path event in the telemetry ring, if telemetry is on.
+ */
+static void heap_telemetry_event(uint32_t type, struct heapinfo_t *heap, uint64_t size, void *addr) {
+    struct heaptelemetry_t *region = atomic_load_explicit(&heap_telemetry.region, memory_order_acquire);
+    if (__builtin_expect(region == NULL, 1)) {
+        return;
+    }
+    switch (type) {
+    case HEAP_EVENT_GROW:
+        atomic_fetch_add_explicit(&region->grows, 1, memory_order_relaxed);
+        break;
+    case HEAP_EVENT_FAIL:
+        atomic_fetch_add_explicit(&region->failures, 1, memory_order_relaxed);
+        break;
+    case HEAP_EVENT_TRIM:
+        atomic_fetch_add_explicit(&region->trims, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&region->bytes_trimmed, size, memory_order_relaxed);
+        break;
+    }
+    if (heap_tid == 0) {
+        heap_tid = (uint32_t)syscall(__NR_gettid); // Once per thread
+    }
+
+    uint64_t index = atomic_fetch_add_explicit(&region->head, 1, memory_order_relaxed);
+    struct heapevent_t *event = &region->events[index & (region->capacity - 1)];
+    atomic_store_explicit(&event->seq, 2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&event->time_ns, heap_now_ns(), memory_order_relaxed);
+    atomic_store_explicit(&event->type, type, memory_order_relaxed);
+    atomic_store_explicit(&event->tid, heap_tid, memory_order_relaxed);
+    atomic_store_explicit(&event->heap, (uintptr_t)heap, memory_order_relaxed);
+    atomic_store_explicit(&event->size, size, memory_order_relaxed);
+    atomic_store_explicit(&event->addr, (uintptr_t)addr, memory_order_relaxed);
+    atomic_store_explicit(&event->seq, 2 * index + 2, memory_order_release);
+
+    heap_telemetry_publish();
+}
+
+/**
+ * @brief Creates the shared telemetry region and starts publishing to it.
+ *
+ * With a name, the region is a POSIX shared memory object, visible as /dev/shm/<name>.
+ * It is created readable by the owner only, as events carry heap addresses, and an
+ * existing object of that name is never reused. Without a name, the region is an
+ * anonymous memfd, reachable as /proc/<pid>/fd/<fd>.
+ *
+ * @param name Shared memory object name starting with '/', or NULL for a memfd.
+ * @param capacity Number of event slots, rounded up to a power of two; 0 selects
+ *                 HEAP_TELEMETRY_EVENTS.
+ * @return The region's file descriptor, or -1 with errno set if telemetry is already
+ *         on (EBUSY), the name is too long (ENAMETOOLONG), the object already exists
+ *         (EEXIST), or the region could not be created.
+ */
+int heap_telemetry_open(const char *name, uint32_t capacity) {
+    if (atomic_load_explicit(&heap_telemetry.region, memory_order_relaxed) != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (name != NULL && strlen(name) >= sizeof(heap_telemetry.name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (capacity == 0) {
+        capacity = HEAP_TELEMETRY_EVENTS;
+    }
+    capacity = capacity > 1 ? 1u << (32 - __builtin_clz(capacity - 1)) : 1;
+    size_t length = sizeof(struct heaptelemetry_t) + (size_t)capacity * sizeof(struct heapevent_t);
+
+    int fd = name != NULL ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+                          : (int)syscall(__NR_memfd_create, "myalloc-telemetry", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct heaptelemetry_t *region = MAP_FAILED;
+    if (ftruncate(fd, (off_t)length) == 0) {
+        region = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (region == MAP_FAILED) {
+        int error = errno;
+        if (name != NULL) {
+            shm_unlink(name);
+        }
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    region->magic = HEAP_TELEMETRY_MAGIC;
+    region->version = HEAP_TELEMETRY_VERSION;
+    region->header_size = sizeof(struct heaptelemetry_t);
+    region->event_size = sizeof(struct heapevent_t);
+    region->capacity = capacity;
+    region->pid = (uint64_t)getpid();
+
+    heap_telemetry.fd = fd;
+    snprintf(heap_telemetry.name, sizeof(heap_telemetry.name), "%s", name != NULL ? name : "");
+    atomic_store_explicit(&heap_telemetry.region, region, memory_order_release);
+    heap_telemetry_publish();
+    return fd;
+}
+
+/**
+ * @brief Stops publishing telemetry and removes the region's name.
+ *
+ * The mapping itself stays until the process exits, so threads still publishing an
+ * event are unaffected; attached readers keep their view of the final state.
+ */
+void heap_telemetry_close(void) {
+    if (atomic_exchange_explicit(&heap_telemetry.region, NULL, memory_order_acq_rel) == NULL) {
+        return;
+    }
+    if (heap_telemetry.name[0] != '\0') {
+        shm_unlink(heap_telemetry.name);
+    }
+    close(heap_telemetry.fd);
+    heap_telemetry.fd = -1;
+}
+
+/**
+ * @brief Returns a chunk to the free list and coalesces it, without counting it.
+ */
+static void heap_free_chunk(struct heapinfo_t *heap, struct heapchunk_t *chunk) {
+    if (chunk->sample != 0) {
+        heap_predict_free(chunk);
+    }
+    chunk->inuse = false;
+    chunk->flags = 0;
+    heap_coalesce(heap, false);
+}
+
+/**
+ * @brief Frees a block like heap_free(), without running the hooks.
+ */
+static void heap_free_unhooked(struct heapinfo_t *heap, void *ptr) {
+    struct heapchunk_t *chunk = (struct heapchunk_t *)ptr - 1;
+    heap_stats_free(chunk);
+    heap_free_chunk(heap, chunk);
+}
+
+/**
+ * @brief Counts every block still allocated from a heap as freed, as the heap is discarded.
+ *
+ * Heaps nested in the heap's blocks are discarded with it.
+ */
+static void heap_discard(struct heapinfo_t *heap) {
+#ifndef HEAP_NO_STATS
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        if (!chunk->inuse || (chunk->flags & HEAP_CHUNK_EXTENT)) {
+            continue; // An extent's chunks are on the list of the child heap that grew by it
+        }
+        if (chunk->flags & HEAP_CHUNK_NESTED) {
+            heap_discard((struct heapinfo_t *)(chunk + 1));
+        } else {
+            heap_stats_free(chunk);
+        }
+    }
+#else
+    (void)heap;
+#endif
+}
+
+/**
+ * @brief Frees the blocks whose last reference heap_release() dropped since the heap's
+ *        last operation.
+ *
+ * Every heap_alloc*() and heap_free() call does this first, so it only needs to be
+ * called for a heap that otherwise sits idle. Like those, it must not run concurrently
+ * with other operations on the heap.
+ *
+ * @param heap A pointer to the heap information structure.
+ */
+void heap_drain(struct heapinfo_t *heap) {
+    if (__builtin_expect(atomic_load_explicit(&heap->deferred, memory_order_relaxed) == NULL, 1)) {
+        return;
+    }
+    void *ptr = atomic_exchange_explicit(&heap->deferred, NULL, memory_order_acquire);
+    while (ptr != NULL) {
+        void *next = *(void **)ptr;
+        HEAP_HOOK(pre_free, heap, ptr);
+        heap_free_unhooked(heap, ptr);
+        HEAP_HOOK(post_free, heap, ptr);
+        ptr = next;
+    }
+}
+
+/**
+ * @brief Allocates first-fit like heap_alloc(), without hooks or prediction.
+ *
+ * Used for blocks the allocator hands out on behalf of another call, which runs the
+ * hooks itself.
+ */
+static void *heap_alloc_unhooked(struct heapinfo_t *heap, uint32_t size) {
+    struct heapchunk_t *chunk = heap_alloc_low(heap, heap_round_size(size));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    heap_stats_alloc(chunk);
+    return chunk + 1;
+}
+
+/**
+ * @brief Takes a block that will hold a heap of its own, such as a child heap or a tag span.
+ *
+ * The block is not counted as an allocation; the blocks allocated inside it are.
+ */
+static void *heap_alloc_nested(struct heapinfo_t *heap, uint32_t size) {
+    struct heapchunk_t *chunk = heap_alloc_low(heap, ALIGN(size));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->flags |= HEAP_CHUNK_NESTED;
+    return chunk + 1;
+}
+
+/**
+ * Allocates a block of memory from the heap.
+ *
+ * This function searches for a free chunk of memory in the heap that is large enough to satisfy the requested size.
+ * If a suitable chunk is found, it is marked as in use, and if the chunk is significantly larger than the requested size,
+ * it is split into two chunks. The first chunk is returned to the caller, and the second chunk remains in the heap as free space.
+ * With lifetime prediction enabled, blocks from sites learned to be long-lived are placed like HEAP_HINT_LONG.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param size The size of the memory block to allocate, in bytes.
+ * @return A pointer to the allocated memory block, or NULL if no suitable chunk is found.
+ */
+void *heap_alloc(struct heapinfo_t *heap, uint32_t size) {
+    heap_drain(heap);
+    HEAP_HOOK(pre_alloc, heap, size);
+    uint32_t rounded = heap_round_size(size);
+    struct heapchunk_t *chunk;
+    if (atomic_load_explicit(&heap_predict_enabled, memory_order_relaxed)) {
+        chunk = heap_alloc_predicted(heap, rounded, __builtin_return_address(0));
+    } else {
+        chunk = heap_alloc_low(heap, rounded);
+    }
+    void *ptr = NULL;
+    if (chunk != NULL) {
+        heap_stats_alloc(chunk);
+        ptr = chunk + 1;
+    } else {
+        heap_telemetry_event(HEAP_EVENT_FAIL, heap, rounded, NULL);
+    }
+    HEAP_HOOK(post_alloc, heap, size, ptr);
+    return ptr;
+}
+
+/**
+ * @brief Allocates a block of memory, segregated by its expected lifetime.
+ *
+ * Short-lived blocks are placed first-fit from the low end of the heap, exactly like
+ * heap_alloc(). Long-lived and permanent blocks are placed last-fit from the high end,
+ * carved off the top of the free chunk: permanent blocks at the very top, long-lived
+ * ones below the lowest permanent block. The populations grow towards each other,
+ * so long-lived objects stay packed and the holes left by short-lived objects coalesce
+ * into large free chunks instead of being pinned between survivors.
+ * An explicit hint always takes precedence over lifetime prediction.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param size The size of the memory block to allocate, in bytes.
+ * @param hint The expected lifetime of the block.
+ * @return A pointer to the allocated memory block, or NULL if no suitable chunk is found.
+ */
+void *heap_alloc_hint(struct heapinfo_t *heap, uint32_t size, enum heap_hint_t hint) {
+    heap_drain(heap);
+    HEAP_HOOK(pre_alloc, heap, size);
+    uint32_t rounded = heap_round_size(size);
+    struct heapchunk_t *chunk;
+    if (hint == HEAP_HINT_SHORT) {
+        chunk = heap_alloc_low(heap, rounded);
+    } else {
+        chunk = heap_alloc_high(heap, rounded, hint);
+    }
+    void *ptr = NULL;
+    if (chunk != NULL) {
+        heap_stats_alloc(chunk);
+        ptr = chunk + 1;
+    } else {
+        heap_telemetry_event(HEAP_EVENT_FAIL, heap, rounded, NULL);
+    }
+    HEAP_HOOK(post_alloc, heap, size, ptr);
+    return ptr;
+}
+
+/**
+ * @brief Maximum distance, in bytes, between a block and its hint for heap_alloc_near().
+ */
+#define HEAP_NEAR_DISTANCE 4096
+
+/**
+ * @brief Finds the free chunk of at least `size` bytes closest to `hint`.
+ *
+ * @return The chunk, or NULL if none lies within HEAP_NEAR_DISTANCE bytes.
+ */
+static struct heapchunk_t *heap_find_near(struct heapinfo_t *heap, uint32_t size, struct heapchunk_t *hint) {
+    uintptr_t lo = (uintptr_t)hint;
+    uintptr_t hi = (uintptr_t)(hint + 1) + hint->size;
+
+    struct heapchunk_t *best = NULL;
+    uintptr_t best_distance = HEAP_NEAR_DISTANCE + 1;
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        uintptr_t start = (uintptr_t)chunk;
+        uintptr_t end = (uintptr_t)(chunk + 1) + chunk->size;
+        if (start > hi + HEAP_NEAR_DISTANCE) {
+            break; // Chunks are in address order, the rest are too far
+        }
+        if (chunk->inuse || chunk->size < size) {
+            continue;
+        }
+        uintptr_t distance = end <= lo ? lo - end : start - hi;
+        if (distance < best_distance) {
+            best = chunk;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Allocates a block of memory close to an existing block.
+ *
+ * Among the free chunks that fit, the one closest to `hint_ptr` is chosen and the block
+ * is carved from its end facing the hint: from the high end of a chunk below the hint and
+ * from the low end of a chunk above it. A free chunk adjacent to the hint therefore yields
+ * a block directly next to it. If no candidate lies within HEAP_NEAR_DISTANCE bytes, the
+ * block is placed like heap_alloc().
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param size The size of the memory block to allocate, in bytes.
+ * @param hint_ptr A block of the same heap to allocate next to, or NULL.
+ * @return A pointer to the allocated memory block, or NULL if no suitable chunk is found.
+ */
+void *heap_alloc_near(struct heapinfo_t *heap, uint32_t size, void *hint_ptr) {
+    heap_drain(heap);
+    HEAP_HOOK(pre_alloc, heap, size);
+    uint32_t rounded = heap_round_size(size);
+    struct heapchunk_t *best = NULL;
+    if (hint_ptr != NULL) {
+        best = heap_find_near(heap, rounded, (struct heapchunk_t *)hint_ptr - 1);
+    }
+    struct heapchunk_t *chunk;
+    if (best == NULL) {
+        chunk = heap_alloc_low(heap, rounded);
+    } else if (best < (struct heapchunk_t *)hint_ptr) {
+        chunk = heap_take_high(best, rounded); // Below the hint: take the end facing it
+    } else {
+        chunk = heap_take_low(best, rounded);
+    }
+    void *ptr = NULL;
+    if (chunk != NULL) {
+        heap_stats_alloc(chunk);
+        ptr = chunk + 1;
+    } else {
+        heap_telemetry_event(HEAP_EVENT_FAIL, heap, rounded, NULL);
+    }
+    HEAP_HOOK(post_alloc, heap, size, ptr);
+    return ptr;
+}
+
+/**
+ * @brief Bulk zeroing and copying for large blocks.
+ *
+ * @details
+ * At or above heap_bulk_nt_min bytes, heap_bulk_zero() and heap_bulk_copy() write with
+ * non-temporal stores, which bypass the cache: zeroing or copying a multi-megabyte block
+ * then neither evicts the caller's hot data nor reads the destination lines first. The
+ * AVX2 or SSE2 kernel is selected once at startup from the CPU's features; other CPUs,
+ * and smaller sizes, use memset() and memcpy(). Huge blocks may be split across the
+ * worker pool started with heap_parallel_start().
+ */
+#define HEAP_BULK_NT_MIN (1u << 21)
+
+static _Atomic size_t heap_bulk_nt_min = HEAP_BULK_NT_MIN;
+
+static void heap_zero_scalar(void *dst, size_t n) {
+    memset(dst, 0, n);
+}
+
+static void heap_copy_scalar(void *dst, const void *src, size_t n) {
+    memcpy(dst, src, n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void heap_zero_avx2(void *dst, size_t n) {
+    uint8_t *d = dst;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    if (head > n) {
+        head = n;
+    }
+    memset(d, 0, head);
+    d += head;
+    n -= head;
+    __m256i zero = _mm256_setzero_si256();
+    for (; n >= 128; n -= 128, d += 128) {
+        _mm256_stream_si256((__m256i *)d, zero);
+        _mm256_stream_si256((__m256i *)(d + 32), zero);
+        _mm256_stream_si256((__m256i *)(d + 64), zero);
+        _mm256_stream_si256((__m256i *)(d + 96), zero);
+    }
+    _mm_sfence();
+    memset(d, 0, n);
+}
+
+__attribute__((target("avx2"))) static void heap_copy_avx2(void *dst, const void *src, size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    if (head > n) {
+        head = n;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+    }
+    _mm_sfence();
+    memcpy(d, s, n);
+}
+
+__attribute__((target("sse2"))) static void heap_zero_sse2(void *dst, size_t n) {
+    uint8_t *d = dst;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > n) {
+        head = n;
+    }
+    memset(d, 0, head);
+    d += head;
+    n -= head;
+    __m128i zero = _mm_setzero_si128();
+    for (; n >= 64; n -= 64, d += 64) {
+        _mm_stream_si128((__m128i *)d, zero);
+        _mm_stream_si128((__m128i *)(d + 16), zero);
+        _mm_stream_si128((__m128i *)(d + 32), zero);
+        _mm_stream_si128((__m128i *)(d + 48), zero);
+    }
+    _mm_sfence();
+    memset(d, 0, n);
+}
+
+__attribute__((target("sse2"))) static void heap_copy_sse2(void *dst, const void *src, size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > n) {
+        head = n;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    _mm_sfence();
+    memcpy(d, s, n);
+}
+#endif
+
+static void (*heap_zero_nt)(void *dst, size_t n) = heap_zero_scalar;
+static void (*heap_copy_nt)(void *dst, const void *src, size_t n) = heap_copy_scalar;
+
+/**
+ * @brief Selects the non-temporal kernels for this CPU, once at startup.
+ */
+__attribute__((constructor)) static void heap_bulk_resolve(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        heap_zero_nt = heap_zero_avx2;
+        heap_copy_nt = heap_copy_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        heap_zero_nt = heap_zero_sse2;
+        heap_copy_nt = heap_copy_sse2;
+    }
+#endif
+}
+
+/**
+ * @brief Parallel zeroing and copying of huge blocks.
+ *
+ * @details
+ * One core cannot saturate memory bandwidth. Once heap_parallel_start() has created a
+ * pool of workers, heap_bulk_zero() and heap_bulk_copy() split blocks of at least
+ * heap_parallel_min bytes into page-aligned parts that the workers and the calling
+ * thread process together. Programs with threads of their own can instead call
+ * heap_bulk_zero_part() or heap_bulk_copy_part() from each of them.
+ */
+#define HEAP_PARALLEL_MIN (64u << 20)
+#define HEAP_PARALLEL_MAX_THREADS 64
+#define HEAP_PARALLEL_PART_ALIGN 4096
+
+static _Atomic size_t heap_parallel_min = HEAP_PARALLEL_MIN;
+
+static struct {
+    pthread_mutex_t busy;       // Held by the thread submitting a job
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t threads[HEAP_PARALLEL_MAX_THREADS];
+    _Atomic uint32_t nthreads;  // Written with `busy` held
+    uint64_t generation;
+    bool stop;
+    void *dst;
+    const void *src;            // NULL for zeroing
+    size_t n;
+    uint32_t nparts;
+    _Atomic uint32_t next;
+    uint32_t finished;
+} heap_pool = {
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * @brief Computes the byte range of part `part` out of `nparts` of an `n`-byte block.
+ */
+static void heap_part_range(size_t n, uint32_t part, uint32_t nparts, size_t *offset, size_t *len) {
+    size_t step = (n / nparts + HEAP_PARALLEL_PART_ALIGN - 1) & ~(size_t)(HEAP_PARALLEL_PART_ALIGN - 1);
+    size_t begin = (size_t)part * step;
+    size_t end = begin + step;
+    if (begin > n) {
+        begin = n;
+    }
+    if (end > n || part == nparts - 1) {
+        end = n;
+    }
+    *offset = begin;
+    *len = end - begin;
+}
+
+/**
+ * @brief Zeroes one part of a block; call once per part, from any threads.
+ *
+ * @param dst The block to zero.
+ * @param n Size of the block in bytes.
+ * @param part Index of the part to zero, below `nparts`.
+ * @param nparts Number of parts the block is split into.
+ */
+void heap_bulk_zero_part(void *dst, size_t n, uint32_t part, uint32_t nparts) {
+    size_t offset, len;
+    heap_part_range(n, part, nparts, &offset, &len);
+    if (len > 0) {
+        heap_zero_nt((uint8_t *)dst + offset, len);
+    }
+}
+
+/**
+ * @brief Copies one part of a block; call once per part, from any threads.
+ *
+ * @param dst The destination; must not overlap `src`.
+ * @param src The source.
+ * @param n Size of the block in bytes.
+ * @param part Index of the part to copy, below `nparts`.
+ * @param nparts Number of parts the block is split into.
+ */
+void heap_bulk_copy_part(void *dst, const void *src, size_t n, uint32_t part, uint32_t nparts) {
+    size_t offset, len;
+    heap_part_range(n, part, nparts, &offset, &len);
+    if (len > 0) {
+        heap_copy_nt((uint8_t *)dst + offset, (const uint8_t *)src + offset, len);
+    }
+}
+
+/**
+ * @brief Processes parts of the current job until none is left.
+ *
+ * @return Number of parts processed.
+ */
+static uint32_t heap_pool_work(void) {
+    uint32_t count = 0;
+    uint32_t part;
+    // Acquire pairs with the release in heap_pool_run(), so a worker still running from a
+    // previous job sees the fields of the job whose part it takes
+    while ((part = atomic_fetch_add_explicit(&heap_pool.next, 1, memory_order_acquire)) < heap_pool.nparts) {
+        if (heap_pool.src != NULL) {
+            heap_bulk_copy_part(heap_pool.dst, heap_pool.src, heap_pool.n, part, heap_pool.nparts);
+        } else {
+            heap_bulk_zero_part(heap_pool.dst, heap_pool.n, part, heap_pool.nparts);
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Reports parts processed by the calling thread.
+ */
+static void heap_pool_finish(uint32_t count) {
+    pthread_mutex_lock(&heap_pool.lock);
+    heap_pool.finished += count;
+    if (heap_pool.finished == heap_pool.nparts) {
+        pthread_cond_signal(&heap_pool.done);
+    }
+    pthread_mutex_unlock(&heap_pool.lock);
+}
+
+static void *heap_pool_main(void *arg) {
+    (void)arg;
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&heap_pool.lock);
+        while (!heap_pool.stop && heap_pool.generation == seen) {
+            pthread_cond_wait(&heap_pool.start, &heap_pool.lock);
+        }
+        if (heap_pool.stop) {
+            pthread_mutex_unlock(&heap_pool.lock);
+            return NULL;
+        }
+        seen = heap_pool.generation;
+        pthread_mutex_unlock(&heap_pool.lock);
+        heap_pool_finish(heap_pool_work());
+    }
+}
+
+/**
+ * @brief Zeroes or copies a block with the worker pool and the calling thread.
+ */
+static void heap_pool_run(void *dst, const void *src, size_t n) {
+    pthread_mutex_lock(&heap_pool.busy);
+    pthread_mutex_lock(&heap_pool.lock);
+    heap_pool.dst = dst;
+    heap_pool.src = src;
+    heap_pool.n = n;
+    heap_pool.nparts = atomic_load_explicit(&heap_pool.nthreads, memory_order_relaxed) + 1;
+    heap_pool.finished = 0;
+    atomic_store_explicit(&heap_pool.next, 0, memory_order_release);
+    heap_pool.generation++;
+    pthread_cond_broadcast(&heap_pool.start);
+    pthread_mutex_unlock(&heap_pool.lock);
+
+    heap_pool_finish(heap_pool_work());
+
+    pthread_mutex_lock(&heap_pool.lock);
+    while (heap_pool.finished < heap_pool.nparts) {
+        pthread_cond_wait(&heap_pool.done, &heap_pool.lock);
+    }
+    pthread_mutex_unlock(&heap_pool.lock);
+    pthread_mutex_unlock(&heap_pool.busy);
+}
+
+/**
+ * @brief Starts the worker pool used for huge zeroing and copying.
+ *
+ * @param nthreads Number of workers, in addition to the calling thread; at most
+ *                 HEAP_PARALLEL_MAX_THREADS.
+ * @return 0 on success, -1 if the pool is already running, the count is invalid or no
+ *         thread could be created.
+ */
+int heap_parallel_start(uint32_t nthreads) {
+    if (nthreads == 0 || nthreads > HEAP_PARALLEL_MAX_THREADS) {
+        return -1;
+    }
+    pthread_mutex_lock(&heap_pool.busy);
+    if (atomic_load_explicit(&heap_pool.nthreads, memory_order_relaxed) != 0) {
+        pthread_mutex_unlock(&heap_pool.busy);
+        return -1;
+    }
+    heap_pool.stop = false;
+    uint32_t started = 0;
+    while (started < nthreads && pthread_create(&heap_pool.threads[started], NULL, heap_pool_main, NULL) == 0) {
+        started++;
+    }
+    atomic_store_explicit(&heap_pool.nthreads, started, memory_order_relaxed);
+    pthread_mutex_unlock(&heap_pool.busy);
+    return started > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Stops the worker pool; huge blocks are then processed by the calling thread alone.
+ */
+void heap_parallel_stop(void) {
+    pthread_mutex_lock(&heap_pool.busy);
+    pthread_mutex_lock(&heap_pool.lock);
+    heap_pool.stop = true;
+    pthread_cond_broadcast(&heap_pool.start);
+    pthread_mutex_unlock(&heap_pool.lock);
+    uint32_t nthreads = atomic_load_explicit(&heap_pool.nthreads, memory_order_relaxed);
+    for (uint32_t i = 0; i < nthreads; i++) {
+        pthread_join(heap_pool.threads[i], NULL);
+    }
+    atomic_store_explicit(&heap_pool.nthreads, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&heap_pool.busy);
+}
+
+/**
+ * @brief Zeroes memory, bypassing the cache for large sizes.
+ *
+ * @param dst The memory to zero.
+ * @param n Number of bytes to zero.
+ */
+void heap_bulk_zero(void *dst, size_t n) {
+    if (n >= atomic_load_explicit(&heap_parallel_min, memory_order_relaxed) &&
+        atomic_load_explicit(&heap_pool.nthreads, memory_order_relaxed) > 0) {
+        heap_pool_run(dst, NULL, n);
+    } else if (n >= atomic_load_explicit(&heap_bulk_nt_min, memory_order_relaxed)) {
+        heap_zero_nt(dst, n);
+    } else {
+        memset(dst, 0, n);
+    }
+}
+
+/**
+ * @brief Copies memory, bypassing the cache for large sizes.
+ *
+ * @param dst The destination; must not overlap `src`.
+ * @param src The source.
+ * @param n Number of bytes to copy.
+ */
+void heap_bulk_copy(void *dst, const void *src, size_t n) {
+    if (n >= atomic_load_explicit(&heap_parallel_min, memory_order_relaxed) &&
+        atomic_load_explicit(&heap_pool.nthreads, memory_order_relaxed) > 0) {
+        heap_pool_run(dst, src, n);
+    } else if (n >= atomic_load_explicit(&heap_bulk_nt_min, memory_order_relaxed)) {
+        heap_copy_nt(dst, src, n);
+    } else {
+        memcpy(dst, src, n);
+    }
+}
+
+/**
+ * @brief Allocates a block of zeroed memory from the heap.
+ *
+ * Free chunks already known to be zero, such as those cleared by heap_zero_idle(), are
+ * preferred, in which case no memset is needed on the calling thread. Otherwise the
+ * block is placed like heap_alloc() and cleared.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param size The size of the memory block to allocate, in bytes.
+ * @return A pointer to the zeroed memory block, or NULL if no suitable chunk is found.
+ */
+void *heap_alloc_zeroed(struct heapinfo_t *heap, uint32_t size) {
+    heap_drain(heap);
+    HEAP_HOOK(pre_alloc, heap, size);
+    uint32_t rounded = heap_round_size(size);
+    struct heapchunk_t *chunk = heap->start;
+    while (chunk != NULL &&
+           (chunk->inuse || !(chunk->flags & HEAP_CHUNK_ZEROED) || chunk->size < rounded)) {
+        chunk = chunk->next;
+    }
+    if (chunk != NULL) {
+        chunk = heap_take_low(chunk, rounded);
+    } else {
+        chunk = heap_alloc_low(heap, rounded);
+        if (chunk != NULL && !(chunk->flags & HEAP_CHUNK_ZEROED)) {
+            heap_bulk_zero(chunk + 1, chunk->size);
+        }
+    }
+    void *ptr = NULL;
+    if (chunk != NULL) {
+        heap_stats_alloc(chunk);
+        ptr = chunk + 1;
+    } else {
+        heap_telemetry_event(HEAP_EVENT_FAIL, heap, rounded, NULL);
+    }
+    HEAP_HOOK(post_alloc, heap, size, ptr);
+    return ptr;
+}
+
+static void *heap_realloc_unhooked(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+   }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    size = ALIGN(size);
+    // The block comes from malloc(), which keeps its own header
+    size_t old_size = malloc_usable_size(ptr);
+    if (old_size >= size) {
+        return ptr;
+    }
+    void *new_ptr = malloc(size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+
+    heap_bulk_copy(new_ptr, ptr, old_size);
+    free(ptr);
+    return new_ptr;
+}
+
+/**
+ * @brief Reallocates a memory block with a new size.
+ *
+ * This function attempts to resize the memory block pointed to by `ptr` to 
+ * `size` bytes. If `ptr` is NULL, it behaves like `malloc(size)`. If `size` 
+ * is 0, it behaves like `free(ptr)` and returns NULL.
+ *
+ * @param ptr Pointer to the memory block to be reallocated. If NULL, a new 
+ *            memory block is allocated.
+ * @param size The new size of the memory block in bytes. If 0, the memory 
+ *             block is freed.
+ * @return A pointer to the newly allocated memory block, or NULL if the 
+ *         allocation fails or if `size` is 0.
+ */
+void *heap_realloc(void *ptr, size_t size) {
+    HEAP_HOOK(pre_realloc, ptr, size);
+    void *new_ptr = heap_realloc_unhooked(ptr, size);
+    HEAP_HOOK(post_realloc, ptr, size, new_ptr);
+    return new_ptr;
+}
+
+/**
+ * @brief Allocates memory for an array of nmemb elements of size bytes each and initializes all bytes in the allocated storage to zero.
+ *
+ * This function is a custom implementation of calloc. It allocates memory for an array of nmemb elements, each of size bytes,
+ * and initializes all bytes in the allocated memory to zero.
+ *
+ * @param nmemb Number of elements to allocate.
+ * @param size Size of each element.
+ * @return Pointer to the allocated memory, or NULL if the allocation fails. If
+ *         `nmemb * size` overflows, errno is set to ENOMEM.
+ */
+void *heap_calloc(size_t nmemb, size_t size) {
+    size_t total_size;
+    if (__builtin_mul_overflow(nmemb, size, &total_size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = malloc(total_size);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    heap_bulk_zero(ptr, total_size);
+    return ptr;
+}
+
+/**
+ * Frees a previously allocated chunk of memory in the heap.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param ptr A pointer to the memory chunk to be freed. If NULL, the function does nothing.
+ *
+ * This function marks the specified memory chunk as free. It does coalesce
+ * adjacent free chunks. The available memory in the heap is updated accordingly.
+ */
+void heap_free(struct heapinfo_t *heap, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    heap_drain(heap);
+    HEAP_HOOK(pre_free, heap, ptr);
+    heap_free_unhooked(heap, ptr);
+    HEAP_HOOK(post_free, heap, ptr);
+}
+
+/**
+ * @brief Initializes a heap with the given start address and size.
+ *
+ * This function sets up the initial heap structure by assigning the start address,
+ * setting the size of the first chunk, marking it as not in use, and initializing
+ * the available memory size.
+ *
+ * @param heap Pointer to the heapinfo_t structure to be initialized.
+ * @param start Pointer to the start address of the heap memory.
+ * @param size Total size of the heap memory in bytes.
+ */
+void heap_init(struct heapinfo_t *heap, void *start, const uint32_t size) {
+    heap_lifetime_forget(start, size);
+    heap->start = (struct heapchunk_t *)start;
+    heap->start->size = size - sizeof(struct heapchunk_t);
+    heap->start->inuse = false;
+    heap->start->flags = 0;
+    heap->start->sample = 0;
+    heap->start->next = NULL;
+    heap->avail = size - sizeof(struct heapchunk_t);
+    heap->parent = NULL;
+    heap->extents = NULL;
+    atomic_init(&heap->deferred, NULL);
+}
+
+/**
+ * @brief Returns the size of a previously allocated memory block.
+ *
+ * This function retrieves the size of a memory block that was previously allocated
+ * from the heap. The size is stored in the heapchunk_t structure that precedes the
+ * memory block.
+ *
+ * @param ptr A pointer to the allocated memory block.
+ * @return The size of the allocated memory block in bytes, or 0 if the pointer is NULL.
+ */
+uint32_t heap_sizeof(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    struct heapchunk_t *chunk = (struct heapchunk_t *)ptr - 1;
+    return chunk->size;
+}
+
+/**
+ * @brief Returns the size actually reserved for a request of `size` bytes.
+ *
+ * Containers can round their capacity up to this size for free: heap_alloc(heap, size)
+ * always yields a block of at least heap_good_size(size) usable bytes.
+ *
+ * @param size The requested size in bytes.
+ * @return The usable size of a block allocated for `size` bytes.
+ */
+uint32_t heap_good_size(uint32_t size) {
+    return heap_round_size(size);
+}
+
+/**
+ * @brief Grows a block in place, never moving it.
+ *
+ * The block grows into the free chunk that directly follows it, if that chunk is large
+ * enough; any excess is split off again as a free chunk. The block is left unchanged
+ * when it cannot grow in place, and the caller can then fall back to copying.
+ *
+ * @param ptr A pointer to an allocated memory block.
+ * @param new_size The requested size in bytes.
+ * @return The usable size of the block afterwards: at least `new_size` on success,
+ *         the unchanged size otherwise.
+ */
+uint32_t heap_expand(void *ptr, uint32_t new_size) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    uint32_t size = heap_round_size(new_size);
+    struct heapchunk_t *chunk = (struct heapchunk_t *)ptr - 1;
+    struct heapchunk_t *next = chunk->next;
+    if (chunk->size >= size) {
+        return chunk->size;
+    }
+    if (next == NULL || next->inuse || !heap_adjacent(chunk, next) ||
+        chunk->size + sizeof(struct heapchunk_t) + next->size < size) {
+        return chunk->size;
+    }
+    uint32_t old_size = chunk->size;
+    chunk->size += sizeof(struct heapchunk_t) + next->size;
+    chunk->next = next->next;
+    if (chunk->size >= size + sizeof(struct heapchunk_t) + ALIGNMENT) {
+        struct heapchunk_t *rest = (struct heapchunk_t *)((uint8_t *)(chunk + 1) + size);
+        rest->size = chunk->size - size - sizeof(struct heapchunk_t);
+        rest->inuse = false;
+        rest->flags = 0;
+        rest->sample = 0;
+        rest->next = chunk->next;
+        chunk->next = rest;
+        chunk->size = size;
+    }
+    heap_stats_resize(old_size, chunk->size);
+    return chunk->size;
+}
+
+/**
+ * @brief Reference counts of shared blocks, kept outside the chunk headers.
+ *
+ * @details
+ * Most blocks are never shared, so a block without an entry has exactly one reference
+ * and costs nothing: an atomic count in every chunk header would grow all of them by
+ * 8 bytes. heap_retain() adds an entry holding the count instead; it is removed when
+ * the count drops back to one. Entries are spread by address over HEAP_REFS_STRIPES
+ * open-addressing tables, each mapped with mmap(), doubled when half full and guarded
+ * by its own mutex, so threads sharing different blocks rarely meet on a lock. Each
+ * stripe keeps an atomic count of its entries, which lets heap_release() skip the lock
+ * entirely for blocks in a stripe holding no shared block.
+ */
+#define HEAP_REFS_INITIAL 256
+#define HEAP_REFS_STRIPES 64
+
+/**
+ * @struct heapref_t
+ * @brief The reference count of one shared block.
+ *
+ * @var heapref_t::ptr
+ * The block, or NULL if the entry is unused.
+ *
+ * @var heapref_t::count
+ * Number of references, at least two.
+ */
+struct heapref_t {
+    void *ptr;
+    uint32_t count;
+};
+
+/**
+ * @struct heaprefstripe_t
+ * @brief One table of reference counts, for the blocks whose address hashes to it.
+ *
+ * @var heaprefstripe_t::lock
+ * Mutex guarding the entries.
+ *
+ * @var heaprefstripe_t::entries
+ * The table, or NULL before the first heap_retain() of a block of this stripe.
+ *
+ * @var heaprefstripe_t::capacity
+ * Number of entries, a power of two, or 0.
+ *
+ * @var heaprefstripe_t::used
+ * Number of entries in use; written with `lock` held, read without it.
+ */
+struct heaprefstripe_t {
+    pthread_mutex_t lock;
+    struct heapref_t *entries;
+    uint32_t capacity;
+    _Atomic uint32_t used;
+} __attribute__((aligned(64)));
+
+static struct heaprefstripe_t heap_refs[HEAP_REFS_STRIPES] = {
+    [0 ... HEAP_REFS_STRIPES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+static inline uint32_t heap_refs_hash(void *ptr) {
+    return (uint32_t)((((uint64_t)(uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/**
+ * @brief Returns the stripe of a block, chosen by the top bits of its hash.
+ */
+static inline struct heaprefstripe_t *heap_refs_stripe(void *ptr) {
+    return &heap_refs[heap_refs_hash(ptr) >> 26];
+}
+
+/**
+ * @brief Finds the entry of a block, or the unused entry where it would go.
+ */
+static struct heapref_t *heap_refs_find(struct heaprefstripe_t *stripe, void *ptr) {
+    uint32_t mask = stripe->capacity - 1;
+    uint32_t i = heap_refs_hash(ptr) & mask;
+    while (stripe->entries[i].ptr != NULL && stripe->entries[i].ptr != ptr) {
+        i = (i + 1) & mask;
+    }
+    return &stripe->entries[i];
+}
+
+/**
+ * @brief Doubles the table of a stripe, or maps the first one.
+ *
+ * @return 0 on success, -1 if the mapping failed.
+ */
+static int heap_refs_grow(struct heaprefstripe_t *stripe) {
+    uint32_t capacity = stripe->capacity > 0 ? stripe->capacity * 2 : HEAP_REFS_INITIAL;
+    struct heapref_t *entries = mmap(NULL, capacity * sizeof(struct heapref_t), PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (entries == MAP_FAILED) {
+        return -1;
+    }
+    struct heapref_t *old = stripe->entries;
+    uint32_t old_capacity = stripe->capacity;
+    stripe->entries = entries;
+    stripe->capacity = capacity;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i].ptr != NULL) {
+            *heap_refs_find(stripe, old[i].ptr) = old[i];
+        }
+    }
+    if (old != NULL) {
+        munmap(old, old_capacity * sizeof(struct heapref_t));
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes an entry, moving later entries of its probe run back into the gap.
+ */
+static void heap_refs_remove(struct heaprefstripe_t *stripe, struct heapref_t *entry) {
+    uint32_t mask = stripe->capacity - 1;
+    uint32_t gap = (uint32_t)(entry - stripe->entries);
+    for (uint32_t i = (gap + 1) & mask; stripe->entries[i].ptr != NULL; i = (i + 1) & mask) {
+        uint32_t home = heap_refs_hash(stripe->entries[i].ptr) & mask;
+        // The entry may fill the gap unless its home lies cyclically in (gap, i]
+        if (gap <= i ? (home <= gap || home > i) : (home <= gap && home > i)) {
+            stripe->entries[gap] = stripe->entries[i];
+            gap = i;
+        }
+    }
+    stripe->entries[gap].ptr = NULL;
+    // Pairs with the acquire in heap_release(): the last holder then frees the block
+    // only after the other holders are done with it
+    atomic_fetch_sub_explicit(&stripe->used, 1, memory_order_release);
+}
+
+/**
+ * @brief Adds a reference to a block, so it can be shared without copying.
+ *
+ * Every block starts with one reference when allocated. References may be taken and
+ * dropped from any thread, as long as a reference is taken before the block is handed
+ * to the thread that will drop it.
+ *
+ * This is an adaptation of a count in each chunk header, which would grow every header
+ * for the few blocks that are shared: counts above one live in a striped side table
+ * (see HEAP_REFS_STRIPES), so retaining takes the lock of one stripe.
+ *
+ * @param ptr A pointer to an allocated memory block.
+ * @return `ptr`, for convenience, or NULL if no memory was left to count the reference.
+ */
+void *heap_retain(void *ptr) {
+    if (ptr == NULL) {
+        return NULL;
+    }
+    struct heaprefstripe_t *stripe = heap_refs_stripe(ptr);
+    pthread_mutex_lock(&stripe->lock);
+    uint32_t used = atomic_load_explicit(&stripe->used, memory_order_relaxed);
+    if ((used + 1) * 2 > stripe->capacity && heap_refs_grow(stripe) != 0) {
+        pthread_mutex_unlock(&stripe->lock);
+        return NULL;
+    }
+    struct heapref_t *entry = heap_refs_find(stripe, ptr);
+    if (entry->ptr == NULL) {
+        entry->ptr = ptr;
+        entry->count = 2;
+        atomic_fetch_add_explicit(&stripe->used, 1, memory_order_relaxed);
+    } else {
+        entry->count++;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return ptr;
+}
+
+/**
+ * @brief Drops a reference to a block, freeing it when the last one goes.
+ *
+ * May be called from any thread. The last reference does not free the block on the
+ * spot, since the heap is not synchronized: the block is queued on its heap, without a
+ * lock, and freed by the heap's next allocation or free, by heap_trim() or
+ * heap_zero_idle(), or by heap_drain(). A heap that may sit idle with released blocks
+ * should be drained by its owner, or served by a heapzeroer_t.
+ *
+ * Dropping a reference to a block that was never retained takes no lock unless another
+ * block of its stripe of the side table (see heap_retain()) is shared at the time.
+ *
+ * @param heap A pointer to the heap the block was allocated from.
+ * @param ptr A pointer to the memory block. If NULL, the function does nothing.
+ */
+void heap_release(struct heapinfo_t *heap, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct heaprefstripe_t *stripe = heap_refs_stripe(ptr);
+    // A retain of this block happened before it reached this thread, so a count of zero
+    // seen here cannot miss its entry
+    if (atomic_load_explicit(&stripe->used, memory_order_acquire) > 0) {
+        pthread_mutex_lock(&stripe->lock);
+        struct heapref_t *entry = heap_refs_find(stripe, ptr);
+        if (entry->ptr == ptr) {
+            if (--entry->count == 1) {
+                heap_refs_remove(stripe, entry);
+            }
+            pthread_mutex_unlock(&stripe->lock);
+            return;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+
+    void *head = atomic_load_explicit(&heap->deferred, memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(&heap->deferred, &head, ptr,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief Prints information about the heap.
+ *
+ * This function prints information about the heap, including the start address,
+ * the available memory, and details about each chunk in the heap.
+ *
+ * @param heap Pointer to the heapinfo_t structure containing information about the heap.
+ */
+char *heap_info(struct heapinfo_t *heap) {
+    static char buffer[1024];
+    char *ptr = buffer;
+    ptr += sprintf(ptr, "Heap start: %p\n", heap->start);
+    ptr += sprintf(ptr, "Available memory: %u bytes\n", heap->avail);
+    struct heapchunk_t *chunk = heap->start;
+    while (chunk != NULL) {
+        ptr += sprintf(ptr, "Chunk: %p, size: %u, inuse: %d\n", chunk, chunk->size, chunk->inuse);
+        chunk = chunk->next;
+    }
+    return buffer;
+}
+
+/**
+ * @brief Returns the memory of free chunks to the operating system.
+ *
+ * The whole pages inside each free chunk are released with madvise(MADV_DONTNEED); the
+ * chunk stays in the list and its pages come back on first touch. Chunk headers, and
+ * the partial pages at the ends of a chunk, are kept. Blocks queued by heap_release()
+ * are freed first.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param pad Bytes at the start of the last chunk, if it is free, to keep resident for
+ *            future allocations, as for malloc_trim().
+ * @return The number of bytes released.
+ */
+size_t heap_trim(struct heapinfo_t *heap, size_t pad) {
+    heap_drain(heap);
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        size_t keep = chunk->next == NULL ? pad : 0;
+        if (chunk->inuse || keep >= chunk->size) {
+            continue;
+        }
+        uintptr_t start = ((uintptr_t)(chunk + 1) + keep + page - 1) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)(chunk + 1) + chunk->size) & ~(page - 1);
+        if (start >= end || madvise((void *)start, end - start, MADV_DONTNEED) != 0) {
+            continue;
+        }
+        chunk->flags &= ~HEAP_CHUNK_ZEROED; // File-backed pages may not come back zeroed
+        released += end - start;
+    }
+    if (released > 0) {
+        heap_telemetry_event(HEAP_EVENT_TRIM, heap, released, NULL);
+    }
+    return released;
+}
+
+/**
+ * @struct heapspan_t
+ * @brief A span carved from a parent heap and managed as a heap of its own.
+ *
+ * The span header sits at the start of the parent block, followed by the span's chunks.
+ *
+ * @var heapspan_t::heap
+ * The span's own heap, with its own chunk list.
+ *
+ * @var heapspan_t::next
+ * Pointer to the next span of the same tag.
+ *
+ * @var heapspan_t::size
+ * Size of the span's heap memory in bytes.
+ */
+struct heapspan_t {
+    struct heapinfo_t heap;
+    struct heapspan_t *next;
+    uint32_t size;
+};
+
+/**
+ * @struct heaptag_t
+ * @brief A tagged sub-heap, e.g. one per type or per subsystem.
+ *
+ * A tag takes spans from its parent heap and serves its allocations only from them, so
+ * objects of one tag stay dense and never share a span with another tag's objects.
+ *
+ * @var heaptag_t::parent
+ * The heap spans are taken from.
+ *
+ * @var heaptag_t::tag
+ * Caller-defined identifier of the tag.
+ *
+ * @var heaptag_t::span_size
+ * Default size of a new span in bytes.
+ *
+ * @var heaptag_t::spans
+ * Pointer to the most recently created span.
+ *
+ * @var heaptag_t::allocated
+ * Bytes currently allocated through the tag.
+ *
+ * @var heaptag_t::reserved
+ * Bytes currently taken from the parent heap, span headers included.
+ */
+struct heaptag_t {
+    struct heapinfo_t *parent;
+    uint32_t tag;
+    uint32_t span_size;
+    struct heapspan_t *spans;
+    uint32_t allocated;
+    uint32_t reserved;
+};
+
+/**
+ * @brief Initializes a tagged sub-heap on top of a parent heap.
+ *
+ * No memory is taken from the parent until the first allocation.
+ *
+ * @param tag Pointer to the heaptag_t structure to be initialized.
+ * @param parent The heap spans are taken from.
+ * @param id Caller-defined identifier of the tag.
+ * @param span_size Default size of a span in bytes.
+ */
+void heap_tag_init(struct heaptag_t *tag, struct heapinfo_t *parent, uint32_t id, uint32_t span_size) {
+    tag->parent = parent;
+    tag->tag = id;
+    tag->span_size = span_size;
+    tag->spans = NULL;
+    tag->allocated = 0;
+    tag->reserved = 0;
+}
+
+/**
+ * @brief Allocates a block of memory from a tagged sub-heap.
+ *
+ * The tag's spans are tried from the newest one. If none has room, a new span of
+ * `span_size` bytes, or more for a large request, is taken from the parent heap.
+ *
+ * @param tag Pointer to the tagged sub-heap.
+ * @param size The size of the memory block to allocate, in bytes.
+ * @return A pointer to the allocated memory block, or NULL if the parent heap is exhausted.
+ */
+void *heap_tag_alloc(struct heaptag_t *tag, uint32_t size) {
+    HEAP_HOOK(pre_alloc, tag->parent, size);
+    void *ptr = NULL;
+    for (struct heapspan_t *span = tag->spans; span != NULL && ptr == NULL; span = span->next) {
+        ptr = heap_alloc_unhooked(&span->heap, size);
+    }
+    if (ptr == NULL) {
+        uint32_t need = heap_round_size(size) + sizeof(struct heapchunk_t) + sizeof(struct heapspan_t);
+        uint32_t span_size = need > tag->span_size ? need : tag->span_size;
+        struct heapspan_t *span = heap_alloc_nested(tag->parent, span_size);
+        if (span != NULL) {
+            span_size = heap_sizeof(span);
+            span->size = span_size - sizeof(struct heapspan_t);
+            heap_init(&span->heap, span + 1, span->size);
+            span->next = tag->spans;
+            tag->spans = span;
+            tag->reserved += span_size;
+            ptr = heap_alloc_unhooked(&span->heap, size);
+        }
+    }
+    if (ptr == NULL) {
+        heap_telemetry_event(HEAP_EVENT_FAIL, tag->parent, heap_round_size(size), NULL);
+    }
+    tag->allocated += heap_sizeof(ptr);
+    HEAP_HOOK(post_alloc, tag->parent, size, ptr);
+    return ptr;
+}
+
+/**
+ * @brief Frees a block allocated from a tagged sub-heap.
+ *
+ * A span left without any allocation is given back to the parent heap, unless it is
+ * the tag's only span.
+ *
+ * @param tag Pointer to the tagged sub-heap.
+ * @param ptr A pointer to the memory block to be freed. If NULL, the function does nothing.
+ */
+void heap_tag_free(struct heaptag_t *tag, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct heapspan_t **link = &tag->spans;
+    while (*link != NULL) {
+        struct heapspan_t *span = *link;
+        if ((uint8_t *)ptr > (uint8_t *)(span + 1) && (uint8_t *)ptr < (uint8_t *)(span + 1) + span->size) {
+            break;
+        }
+        link = &span->next;
+    }
+    struct heapspan_t *span = *link;
+    if (span == NULL) {
+        return; // Not allocated from this tag
+    }
+    HEAP_HOOK(pre_free, tag->parent, ptr);
+    tag->allocated -= heap_sizeof(ptr);
+    heap_free_unhooked(&span->heap, ptr);
+
+    bool empty = tag->spans->next != NULL;
+    for (struct heapchunk_t *chunk = span->heap.start; chunk != NULL && empty; chunk = chunk->next) {
+        empty = !chunk->inuse;
+    }
+    if (empty) {
+        *link = span->next;
+        tag->reserved -= heap_sizeof(span);
+        heap_free_chunk(tag->parent, (struct heapchunk_t *)span - 1);
+    }
+    HEAP_HOOK(post_free, tag->parent, ptr);
+}
+
+/**
+ * @brief Frees every block of a tagged sub-heap at once.
+ *
+ * All spans are given back to the parent heap. The tag stays initialized and can be reused.
+ *
+ * @param tag Pointer to the tagged sub-heap.
+ */
+void heap_tag_drop(struct heaptag_t *tag) {
+    struct heapspan_t *span = tag->spans;
+    while (span != NULL) {
+        struct heapspan_t *next = span->next;
+        heap_discard(&span->heap);
+        heap_free_chunk(tag->parent, (struct heapchunk_t *)span - 1);
+        span = next;
+    }
+    tag->spans = NULL;
+    tag->allocated = 0;
+    tag->reserved = 0;
+}
+
+/**
+ * @struct heapslot_t
+ * @brief A heap handed out by a heap factory, followed by its memory.
+ *
+ * @var heapslot_t::heap
+ * The heap itself; heap_create() returns a pointer to this member.
+ *
+ * @var heapslot_t::next_free
+ * Pointer to the next free slot while the slot is in the factory's reservoir.
+ */
+struct heapslot_t {
+    struct heapinfo_t heap;
+    struct heapslot_t *next_free;
+};
+
+/**
+ * @struct heapbatch_t
+ * @brief Header of one mapping of heap slots.
+ *
+ * @var heapbatch_t::next
+ * Pointer to the previously mapped batch.
+ *
+ * @var heapbatch_t::length
+ * Length of the mapping in bytes.
+ */
+struct heapbatch_t {
+    struct heapbatch_t *next;
+    size_t length;
+};
+
+/**
+ * @struct heapfactory_t
+ * @brief A reservoir of pre-mapped heaps for cheap heap creation and destruction.
+ *
+ * Heaps are mapped `batch` at a time. heap_create() and heap_destroy() only move slots
+ * on and off a free list, so a steady state of creations and destructions makes no
+ * system calls; the reservoir maps another batch only when it runs dry.
+ *
+ * @var heapfactory_t::region_size
+ * Size of each heap's memory in bytes.
+ *
+ * @var heapfactory_t::batch
+ * Number of heaps mapped at once.
+ *
+ * @var heapfactory_t::free
+ * Pointer to the first free slot.
+ *
+ * @var heapfactory_t::batches
+ * Pointer to the most recently mapped batch.
+ */
+struct heapfactory_t {
+    uint32_t region_size;
+    uint32_t batch;
+    struct heapslot_t *free;
+    struct heapbatch_t *batches;
+};
+
+#define HEAP_SLOT_SIZE(factory) (ALIGN(sizeof(struct heapslot_t)) + (size_t)(factory)->region_size)
+
+/**
+ * @brief Maps one more batch of heap slots into the factory's reservoir.
+ *
+ * @param factory Pointer to the heap factory.
+ * @return 0 on success, -1 if the mapping failed.
+ */
+static int heap_factory_grow(struct heapfactory_t *factory) {
+    size_t stride = HEAP_SLOT_SIZE(factory);
+    size_t length = ALIGN(sizeof(struct heapbatch_t)) + stride * factory->batch;
+    void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return -1;
+    }
+    struct heapbatch_t *batch = memory;
+    batch->length = length;
+    batch->next = factory->batches;
+    factory->batches = batch;
+
+    uint8_t *slots = (uint8_t *)memory + ALIGN(sizeof(struct heapbatch_t));
+    for (uint32_t i = factory->batch; i > 0; i--) {
+        struct heapslot_t *slot = (struct heapslot_t *)(slots + stride * (i - 1));
+        slot->next_free = factory->free;
+        factory->free = slot;
+    }
+    return 0;
+}
+
+/**
+ * @brief Initializes a heap factory and maps its first batch of heaps.
+ *
+ * @param factory Pointer to the heapfactory_t structure to be initialized.
+ * @param region_size Size of each heap's memory in bytes.
+ * @param batch Number of heaps to map at once.
+ * @return 0 on success, -1 if the mapping failed.
+ */
+int heap_factory_init(struct heapfactory_t *factory, uint32_t region_size, uint32_t batch) {
+    factory->region_size = ALIGN(region_size);
+    factory->batch = batch > 0 ? batch : 1;
+    factory->free = NULL;
+    factory->batches = NULL;
+    return heap_factory_grow(factory);
+}
+
+/**
+ * @brief Creates a heap from the factory's reservoir.
+ *
+ * @param factory Pointer to the heap factory.
+ * @return A pointer to an initialized, empty heap, or NULL if the reservoir could not grow.
+ */
+struct heapinfo_t *heap_create(struct heapfactory_t *factory) {
+    if (factory->free == NULL && heap_factory_grow(factory) != 0) {
+        return NULL;
+    }
+    struct heapslot_t *slot = factory->free;
+    factory->free = slot->next_free;
+    heap_init(&slot->heap, (uint8_t *)slot + ALIGN(sizeof(struct heapslot_t)), factory->region_size);
+    return &slot->heap;
+}
+
+/**
+ * @brief Destroys a heap created by heap_create(), returning its memory wholesale.
+ *
+ * Blocks still allocated from the heap are released with it.
+ *
+ * @param factory Pointer to the heap factory the heap was created from.
+ * @param heap The heap to destroy. If NULL, the function does nothing.
+ */
+void heap_destroy(struct heapfactory_t *factory, struct heapinfo_t *heap) {
+    if (heap == NULL) {
+        return;
+    }
+    heap_discard(heap);
+    struct heapslot_t *slot = (struct heapslot_t *)heap;
+    slot->next_free = factory->free;
+    factory->free = slot;
+}
+
+/**
+ * @brief Unmaps every batch of a heap factory.
+ *
+ * All heaps created from the factory become invalid.
+ *
+ * @param factory Pointer to the heap factory.
+ */
+void heap_factory_destroy(struct heapfactory_t *factory) {
+    struct heapbatch_t *batch = factory->batches;
+    while (batch != NULL) {
+        struct heapbatch_t *next = batch->next;
+        munmap(batch, batch->length);
+        batch = next;
+    }
+    factory->batches = NULL;
+    factory->free = NULL;
+}
+
+/**
+ * @brief Creates a child heap inside a block of a parent heap.
+ *
+ * The child's heapinfo_t lives at the start of the block and the rest of the block is
+ * the child's memory. When the child runs out of memory it grows with extents of at
+ * least HEAP_CHILD_GROW bytes taken from the parent, so nested heaps never involve the OS.
+ *
+ * @param parent The heap to carve the child from.
+ * @param size Initial size of the child's memory in bytes.
+ * @return A pointer to the child heap, or NULL if the parent is exhausted.
+ */
+struct heapinfo_t *heap_create_child(struct heapinfo_t *parent, uint32_t size) {
+    uint32_t header = ALIGN(sizeof(struct heapinfo_t));
+    uint32_t need = header + sizeof(struct heapchunk_t) + ALIGN(size);
+    struct heapinfo_t *child = heap_alloc_nested(parent, need);
+    if (child == NULL) {
+        heap_telemetry_event(HEAP_EVENT_FAIL, parent, need, NULL);
+        return NULL;
+    }
+    heap_init(child, (uint8_t *)child + header, heap_sizeof(child) - header);
+    child->parent = parent;
+    return child;
+}
+
+/**
+ * @brief Destroys a child heap, returning all of its memory to the parent.
+ *
+ * Blocks still allocated from the child are released with it. The initial region goes
+ * back to the parent in one free, plus one per extent the child grew by.
+ *
+ * @param child A heap created by heap_create_child(). If NULL, the function does nothing.
+ */
+void heap_destroy_child(struct heapinfo_t *child) {
+    if (child == NULL) {
+        return;
+    }
+    heap_discard(child);
+    struct heapinfo_t *parent = child->parent;
+    struct heapextent_t *extent = child->extents;
+    while (extent != NULL) {
+        struct heapextent_t *next = extent->next;
+        heap_free_chunk(parent, (struct heapchunk_t *)extent - 1);
+        extent = next;
+    }
+    heap_free_chunk(parent, (struct heapchunk_t *)child - 1);
+}
+
+/**
+ * @struct heapring_t
+ * @brief A ring allocator for records that are mostly freed in allocation order.
+ *
+ * Records are allocated contiguously at the head and reclaimed from the tail. A record
+ * freed out of order is only flagged; it is reclaimed once every older record is freed
+ * too. Allocation and free are O(1) (amortized for free), with no search and no
+ * coalescing. The region can be any memory, such as a block from heap_alloc().
+ *
+ * @var heapring_t::base
+ * Start of the ring's memory.
+ *
+ * @var heapring_t::size
+ * Size of the ring's memory in bytes.
+ *
+ * @var heapring_t::head
+ * Offset where the next record is allocated.
+ *
+ * @var heapring_t::tail
+ * Offset of the oldest record not yet reclaimed.
+ *
+ * @var heapring_t::used
+ * Bytes between tail and head, record headers and wrap padding included.
+ */
+struct heapring_t {
+    uint8_t *base;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;
+};
+
+/**
+ * @struct heaprecord_t
+ * @brief Header preceding each record of a ring.
+ *
+ * @var heaprecord_t::size
+ * Size of the record in bytes, header included.
+ *
+ * @var heaprecord_t::flags
+ * HEAP_RECORD_FREED once the record is freed, HEAP_RECORD_PAD for wrap padding.
+ */
+struct heaprecord_t {
+    uint32_t size;
+    uint32_t flags;
+};
+
+#define HEAP_RECORD_FREED 0x1
+#define HEAP_RECORD_PAD 0x2
+
+/**
+ * @brief Initializes a ring allocator over the given memory.
+ *
+ * @param ring Pointer to the heapring_t structure to be initialized.
+ * @param start Pointer to the start of the ring's memory, aligned to ALIGNMENT.
+ * @param size Size of the ring's memory in bytes.
+ */
+void heap_ring_init(struct heapring_t *ring, void *start, uint32_t size) {
+    ring->base = (uint8_t *)start;
+    ring->size = size & ~(ALIGNMENT - 1);
+    ring->head = 0;
+    ring->tail = 0;
+    ring->used = 0;
+}
+
+/**
+ * @brief Allocates a record at the head of the ring.
+ *
+ * If the record does not fit before the end of the ring, the rest of the ring is
+ * padded and the record is placed at its start, provided the tail has moved past it.
+ *
+ * @param ring Pointer to the ring allocator.
+ * @param size The size of the record, in bytes.
+ * @return A pointer to the record, or NULL if the ring is full.
+ */
+void *heap_ring_alloc(struct heapring_t *ring, uint32_t size) {
+    uint32_t total = sizeof(struct heaprecord_t) + ALIGN(size);
+    if (ring->used == 0) {
+        ring->head = ring->tail = 0;
+    }
+    if (ring->head < ring->tail) {
+        if (total > ring->tail - ring->head) {
+            return NULL;
+        }
+    } else if (ring->used == ring->size) {
+        return NULL;
+    } else if (total > ring->size - ring->head) {
+        if (total > ring->tail) {
+            return NULL;
+        }
+        struct heaprecord_t *pad = (struct heaprecord_t *)(ring->base + ring->head);
+        pad->size = ring->size - ring->head;
+        pad->flags = HEAP_RECORD_PAD;
+        ring->used += pad->size;
+        ring->head = 0;
+    }
+
+    struct heaprecord_t *record = (struct heaprecord_t *)(ring->base + ring->head);
+    record->size = total;
+    record->flags = 0;
+    ring->used += total;
+    ring->head += total;
+    if (ring->head == ring->size) {
+        ring->head = 0;
+    }
+    return (void *)(record + 1);
+}
+
+/**
+ * @brief Frees a record of the ring.
+ *
+ * The record is flagged as freed, then every freed record and padding at the tail is
+ * reclaimed in order.
+ *
+ * @param ring Pointer to the ring allocator.
+ * @param ptr A pointer to the record to be freed. If NULL, the function does nothing.
+ */
+void heap_ring_free(struct heapring_t *ring, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct heaprecord_t *record = (struct heaprecord_t *)ptr - 1;
+    record->flags |= HEAP_RECORD_FREED;
+
+    while (ring->used > 0) {
+        struct heaprecord_t *oldest = (struct heaprecord_t *)(ring->base + ring->tail);
+        if (!(oldest->flags & (HEAP_RECORD_FREED | HEAP_RECORD_PAD))) {
+            break;
+        }
+        ring->used -= oldest->size;
+        ring->tail += oldest->size;
+        if (ring->tail == ring->size) {
+            ring->tail = 0;
+        }
+    }
+}
+
+/**
+ * @struct heapmsgbuf_t
+ * @brief A lock-free message buffer for zero-copy handoff between threads.
+ *
+ * @details
+ * This is the ring allocator made concurrent. Producers reserve a message at the head
+ * with heap_msgbuf_alloc(), fill it in place and publish it with heap_msgbuf_publish().
+ * The single consumer takes published messages in order with heap_msgbuf_next() and
+ * frees them with heap_msgbuf_free() once processed, in any order. In the single-producer
+ * variant the head is advanced with a plain store, in the multi-producer variant with a
+ * compare-and-swap. No operation takes a lock.
+ *
+ * Head, tail and the consumer's read cursor are 64-bit positions that only grow, each on
+ * its own cache line. A message header is 0 until it is published, which is how the
+ * consumer finds the end of the published data; to keep that true, the consumer zeroes
+ * reclaimed messages before it releases their space to producers.
+ *
+ * @var heapmsgbuf_t::base
+ * Start of the buffer's memory.
+ *
+ * @var heapmsgbuf_t::mask
+ * Size of the buffer minus one; the size is a power of two.
+ *
+ * @var heapmsgbuf_t::multi
+ * true if several threads may produce concurrently.
+ *
+ * @var heapmsgbuf_t::head
+ * Position of the next reservation, written by producers.
+ *
+ * @var heapmsgbuf_t::tail
+ * Position up to which space is reclaimed, written by the consumer.
+ *
+ * @var heapmsgbuf_t::read
+ * Position of the next message to hand to the consumer, private to the consumer.
+ */
+struct heapmsgbuf_t {
+    uint8_t *base;
+    uint64_t mask;
+    bool multi;
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) _Atomic uint64_t tail;
+    _Alignas(64) uint64_t read;
+};
+
+/**
+ * @struct heapmsg_t
+ * @brief Header preceding each message of a message buffer.
+ *
+ * @var heapmsg_t::word
+ * Size of the message, header included, or'ed with HEAP_MSG_* flags; 0 until published.
+ *
+ * @var heapmsg_t::size
+ * Size of the message, header included, as reserved by the producer.
+ */
+struct heapmsg_t {
+    _Atomic uint32_t word;
+    uint32_t size;
+};
+
+#define HEAP_MSG_READY 0x1
+#define HEAP_MSG_PAD 0x2
+#define HEAP_MSG_FREED 0x4
+#define HEAP_MSG_FLAGS (HEAP_MSG_READY | HEAP_MSG_PAD | HEAP_MSG_FREED)
+
+/**
+ * @brief Initializes a message buffer over the given memory.
+ *
+ * Only the largest power of two not exceeding `size` is used. The memory is zeroed.
+ *
+ * @param buf Pointer to the heapmsgbuf_t structure to be initialized.
+ * @param start Pointer to the start of the buffer's memory, aligned to ALIGNMENT.
+ * @param size Size of the buffer's memory in bytes, at least 16, so that a message
+ *             fits with its header.
+ * @param multi true to allow several concurrent producers.
+ * @return 0 on success, -1 if `size` is too small.
+ */
+int heap_msgbuf_init(struct heapmsgbuf_t *buf, void *start, uint32_t size, bool multi) {
+    if (size < sizeof(struct heapmsg_t) + ALIGNMENT) {
+        return -1;
+    }
+    uint32_t cap = 1u << (31 - __builtin_clz(size));
+    memset(start, 0, cap);
+    buf->base = (uint8_t *)start;
+    buf->mask = cap - 1;
+    buf->multi = multi;
+    atomic_init(&buf->head, 0);
+    atomic_init(&buf->tail, 0);
+    buf->read = 0;
+    return 0;
+}
+
+/**
+ * @brief Reserves a message at the head of the buffer.
+ *
+ * The message is invisible to the consumer until heap_msgbuf_publish() is called.
+ * Messages are delivered in reservation order, so a reserved message that is never
+ * published stalls delivery.
+ *
+ * @param buf Pointer to the message buffer.
+ * @param size The size of the message, in bytes.
+ * @return A pointer to the message, or NULL if the buffer is full.
+ */
+void *heap_msgbuf_alloc(struct heapmsgbuf_t *buf, uint32_t size) {
+    uint64_t cap = buf->mask + 1;
+    uint64_t total = sizeof(struct heapmsg_t) + ALIGN((uint64_t)size);
+    uint64_t head, pad;
+    if (total > cap) {
+        return NULL;
+    }
+    head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    for (;;) {
+        uint64_t room = cap - (head & buf->mask);
+        pad = room < total ? room : 0;
+        if (head + pad + total - atomic_load_explicit(&buf->tail, memory_order_acquire) > cap) {
+            return NULL;
+        }
+        if (!buf->multi) {
+            atomic_store_explicit(&buf->head, head + pad + total, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&buf->head, &head, head + pad + total,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (pad != 0) {
+        struct heapmsg_t *filler = (struct heapmsg_t *)(buf->base + (head & buf->mask));
+        filler->size = (uint32_t)pad;
+        atomic_store_explicit(&filler->word, (uint32_t)pad | HEAP_MSG_READY | HEAP_MSG_PAD, memory_order_release);
+    }
+    struct heapmsg_t *msg = (struct heapmsg_t *)(buf->base + ((head + pad) & buf->mask));
+    msg->size = (uint32_t)total;
+    return (void *)(msg + 1);
+}
+
+/**
+ * @brief Publishes a reserved message to the consumer.
+ *
+ * @param buf Pointer to the message buffer.
+ * @param ptr A message returned by heap_msgbuf_alloc().
+ */
+void heap_msgbuf_publish(struct heapmsgbuf_t *buf, void *ptr) {
+    (void)buf;
+    struct heapmsg_t *msg = (struct heapmsg_t *)ptr - 1;
+    atomic_store_explicit(&msg->word, msg->size | HEAP_MSG_READY, memory_order_release);
+}
+
+/**
+ * @brief Takes the next published message, consumer side.
+ *
+ * @param buf Pointer to the message buffer.
+ * @param size Receives the usable size of the message if not NULL.
+ * @return A pointer to the message, or NULL if no published message is pending.
+ */
+void *heap_msgbuf_next(struct heapmsgbuf_t *buf, uint32_t *size) {
+    for (;;) {
+        struct heapmsg_t *msg = (struct heapmsg_t *)(buf->base + (buf->read & buf->mask));
+        uint32_t word = atomic_load_explicit(&msg->word, memory_order_acquire);
+        if (!(word & HEAP_MSG_READY)) {
+            return NULL;
+        }
+        buf->read += word & ~HEAP_MSG_FLAGS;
+        if (!(word & HEAP_MSG_PAD)) {
+            if (size != NULL) {
+                *size = (word & ~HEAP_MSG_FLAGS) - sizeof(struct heapmsg_t);
+            }
+            return (void *)(msg + 1);
+        }
+    }
+}
+
+/**
+ * @brief Frees a message taken with heap_msgbuf_next(), consumer side.
+ *
+ * Messages may be freed in any order. Space is reclaimed from the tail once every older
+ * message is freed; reclaimed messages are zeroed before producers can reuse them.
+ *
+ * @param buf Pointer to the message buffer.
+ * @param ptr A pointer to the message to be freed. If NULL, the function does nothing.
+ */
+void heap_msgbuf_free(struct heapmsgbuf_t *buf, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct heapmsg_t *msg = (struct heapmsg_t *)ptr - 1;
+    atomic_fetch_or_explicit(&msg->word, HEAP_MSG_FREED, memory_order_relaxed);
+
+    uint64_t tail = atomic_load_explicit(&buf->tail, memory_order_relaxed);
+    uint64_t start = tail;
+    while (tail < buf->read) {
+        struct heapmsg_t *oldest = (struct heapmsg_t *)(buf->base + (tail & buf->mask));
+        uint32_t word = atomic_load_explicit(&oldest->word, memory_order_relaxed);
+        if (!(word & (HEAP_MSG_FREED | HEAP_MSG_PAD))) {
+            break;
+        }
+        memset(oldest, 0, word & ~HEAP_MSG_FLAGS);
+        tail += word & ~HEAP_MSG_FLAGS;
+    }
+    if (tail != start) {
+        atomic_store_explicit(&buf->tail, tail, memory_order_release);
+    }
+}
+
+/**
+ * @struct heapuring_t
+ * @brief A pool of fixed-size I/O buffers registered with an io_uring instance.
+ *
+ * @details
+ * The pool maps one region, cuts it into `count` buffers of `buf_size` bytes and registers
+ * it once with the ring, both as fixed buffers (buffer index i for READ_FIXED/WRITE_FIXED)
+ * and, if the kernel supports it, as a provided buffer ring in group `bgid` (buffer id i
+ * for IOSQE_BUFFER_SELECT). A buffer is owned by exactly one party at a time: the pool
+ * (heap_uring_get() hands it out), the caller, or the kernel (after heap_uring_provide(),
+ * until a completion returns its id in `cqe->flags >> IORING_CQE_BUFFER_SHIFT`).
+ *
+ * Registration failures are not fatal: `fixed` and `provided` tell what the kernel
+ * accepted, and with a ring_fd of -1 the pool is a plain buffer pool, which keeps it
+ * usable where io_uring is unavailable.
+ *
+ * @var heapuring_t::ring_fd
+ * The io_uring file descriptor, or -1.
+ *
+ * @var heapuring_t::base
+ * Start of the buffer region.
+ *
+ * @var heapuring_t::length
+ * Length of the buffer region mapping in bytes, free list and bitmap included.
+ *
+ * @var heapuring_t::buf_size
+ * Size of each buffer in bytes.
+ *
+ * @var heapuring_t::count
+ * Number of buffers.
+ *
+ * @var heapuring_t::bgid
+ * Buffer group id of the provided buffer ring.
+ *
+ * @var heapuring_t::free
+ * Stack of the indices of free buffers, stored after the buffers.
+ *
+ * @var heapuring_t::nfree
+ * Number of free buffers.
+ *
+ * @var heapuring_t::taken
+ * Bitmap of the buffers handed out by heap_uring_get(), stored after the free stack.
+ *
+ * @var heapuring_t::ring
+ * The provided buffer ring shared with the kernel, or NULL.
+ *
+ * @var heapuring_t::ring_length
+ * Length of the provided buffer ring mapping in bytes.
+ *
+ * @var heapuring_t::ring_tail
+ * Next tail of the provided buffer ring.
+ *
+ * @var heapuring_t::fixed
+ * true if the buffers are registered as fixed buffers.
+ *
+ * @var heapuring_t::provided
+ * true if the provided buffer ring is registered.
+ */
+struct heapuring_t {
+    int ring_fd;
+    uint8_t *base;
+    size_t length;
+    uint32_t buf_size;
+    uint16_t count;
+    uint16_t bgid;
+    uint16_t *free;
+    uint16_t nfree;
+    uint64_t *taken;
+    struct io_uring_buf_ring *ring;
+    size_t ring_length;
+    uint16_t ring_tail;
+    bool fixed;
+    bool provided;
+};
+
+#define HEAP_URING_MAX_BUFFERS 16384
+
+/**
+ * @brief Registers the pool's buffers as fixed buffers.
+ */
+static bool heap_uring_register_fixed(struct heapuring_t *pool) {
+    struct iovec *iov = malloc(pool->count * sizeof(struct iovec));
+    if (iov == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < pool->count; i++) {
+        iov[i].iov_base = pool->base + (size_t)i * pool->buf_size;
+        iov[i].iov_len = pool->buf_size;
+    }
+    long ret = syscall(__NR_io_uring_register, pool->ring_fd, IORING_REGISTER_BUFFERS, iov, pool->count);
+    free(iov);
+    return ret == 0;
+}
+
+/**
+ * @brief Maps and registers the provided buffer ring of the pool.
+ */
+static bool heap_uring_register_provided(struct heapuring_t *pool) {
+    uint32_t entries = 1;
+    while (entries < pool->count) {
+        entries <<= 1;
+    }
+    pool->ring_length = entries * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, pool->ring_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)ring;
+    reg.ring_entries = entries;
+    reg.bgid = pool->bgid;
+    if (syscall(__NR_io_uring_register, pool->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(ring, pool->ring_length);
+        return false;
+    }
+    pool->ring = ring;
+    pool->ring_tail = 0;
+    return true;
+}
+
+/**
+ * @brief Creates a pool of I/O buffers and registers it with an io_uring instance.
+ *
+ * @param pool Pointer to the heapuring_t structure to be initialized.
+ * @param ring_fd The io_uring file descriptor, or -1 for an unregistered pool.
+ * @param buf_size Size of each buffer in bytes, rounded up to ALIGNMENT.
+ * @param count Number of buffers, at most HEAP_URING_MAX_BUFFERS.
+ * @param bgid Buffer group id to register the provided buffer ring under.
+ * @return 0 on success, -1 if the arguments are invalid or the region could not be mapped.
+ */
+int heap_uring_init(struct heapuring_t *pool, int ring_fd, uint32_t buf_size, uint32_t count, uint16_t bgid) {
+    memset(pool, 0, sizeof(*pool));
+    if (buf_size == 0 || count == 0 || count > HEAP_URING_MAX_BUFFERS) {
+        return -1;
+    }
+    pool->ring_fd = ring_fd;
+    pool->buf_size = ALIGN(buf_size);
+    pool->count = (uint16_t)count;
+    pool->bgid = bgid;
+
+    size_t buffers = (size_t)pool->buf_size * count;
+    size_t stack = ALIGN(count * sizeof(uint16_t));
+    pool->length = buffers + stack + (count + 63) / 64 * sizeof(uint64_t);
+    void *memory = mmap(NULL, pool->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return -1;
+    }
+    pool->base = memory;
+    pool->free = (uint16_t *)(pool->base + buffers);
+    pool->taken = (uint64_t *)(pool->base + buffers + stack);
+    for (uint32_t i = 0; i < count; i++) {
+        pool->free[i] = (uint16_t)(count - 1 - i);
+    }
+    pool->nfree = (uint16_t)count;
+
+    if (ring_fd >= 0) {
+        pool->fixed = heap_uring_register_fixed(pool);
+        pool->provided = heap_uring_register_provided(pool);
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the buffer with the given index or buffer id.
+ */
+void *heap_uring_buf(struct heapuring_t *pool, uint16_t index) {
+    return pool->base + (size_t)index * pool->buf_size;
+}
+
+/**
+ * @brief Takes a free buffer from the pool.
+ *
+ * @param pool Pointer to the buffer pool.
+ * @param index Receives the buffer's fixed-buffer index, which is also its buffer id.
+ * @return A pointer to the buffer, or NULL if every buffer is in use.
+ */
+void *heap_uring_get(struct heapuring_t *pool, uint16_t *index) {
+    if (pool->nfree == 0) {
+        return NULL;
+    }
+    *index = pool->free[--pool->nfree];
+    pool->taken[*index / 64] |= 1ull << (*index % 64);
+    return heap_uring_buf(pool, *index);
+}
+
+/**
+ * @brief Gives a buffer back to the pool.
+ *
+ * @param pool Pointer to the buffer pool.
+ * @param index The buffer's index.
+ * @return 0 on success, -1 if the index is out of range or the buffer is not taken.
+ */
+int heap_uring_put(struct heapuring_t *pool, uint16_t index) {
+    if (index >= pool->count || (pool->taken[index / 64] & (1ull << (index % 64))) == 0) {
+        return -1;
+    }
+    pool->taken[index / 64] &= ~(1ull << (index % 64));
+    pool->free[pool->nfree++] = index;
+    return 0;
+}
+
+/**
+ * @brief Hands a buffer to the kernel through the provided buffer ring.
+ *
+ * The kernel picks it for a request submitted with IOSQE_BUFFER_SELECT and the pool's
+ * buffer group, and reports its id in the completion.
+ *
+ * @param pool Pointer to the buffer pool.
+ * @param index The buffer's index, owned by the caller.
+ * @return 0 on success, -1 if the pool has no provided buffer ring or the buffer is not
+ *         taken.
+ */
+int heap_uring_provide(struct heapuring_t *pool, uint16_t index) {
+    if (!pool->provided || index >= pool->count || (pool->taken[index / 64] & (1ull << (index % 64))) == 0) {
+        return -1;
+    }
+    uint16_t mask = (uint16_t)(pool->ring_length / sizeof(struct io_uring_buf) - 1);
+    struct io_uring_buf *buf = &pool->ring->bufs[pool->ring_tail & mask];
+    buf->addr = (uintptr_t)heap_uring_buf(pool, index);
+    buf->len = pool->buf_size;
+    buf->bid = index;
+    pool->ring_tail++;
+    atomic_store_explicit((_Atomic uint16_t *)&pool->ring->tail, pool->ring_tail, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Unregisters the pool from its io_uring instance and unmaps it.
+ *
+ * @param pool Pointer to the buffer pool.
+ */
+void heap_uring_destroy(struct heapuring_t *pool) {
+    if (pool->provided) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = pool->bgid;
+        syscall(__NR_io_uring_register, pool->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(pool->ring, pool->ring_length);
+    }
+    if (pool->fixed) {
+        syscall(__NR_io_uring_register, pool->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    }
+    if (pool->base != NULL) {
+        munmap(pool->base, pool->length);
+    }
+    memset(pool, 0, sizeof(*pool));
+    pool->ring_fd = -1;
+}
+
+/**
+ * @struct heappinned_t
+ * @brief A heap of locked, block-aligned buffers for direct I/O.
+ *
+ * @details
+ * Allocations are whole blocks (4 KiB by default) and start on a block boundary, as
+ * O_DIRECT requires. Chunk headers would break that alignment, so the heap keeps its
+ * bookkeeping out of band: `runs[i]` is the length in blocks of the allocation starting at
+ * block i, or 0. The memory is prefaulted and mlock'ed so it never pages out; when the
+ * RLIMIT_MEMLOCK limit or missing privileges prevent locking, the heap still works with
+ * ordinary pages and reports it.
+ *
+ * @var heappinned_t::mapping
+ * Start of the mapping.
+ *
+ * @var heappinned_t::length
+ * Length of the mapping in bytes.
+ *
+ * @var heappinned_t::base
+ * First block.
+ *
+ * @var heappinned_t::block
+ * Block size in bytes, a power of two.
+ *
+ * @var heappinned_t::nblocks
+ * Number of blocks.
+ *
+ * @var heappinned_t::runs
+ * Allocation length in blocks for each block that starts an allocation, 0 otherwise.
+ *
+ * @var heappinned_t::locked
+ * true if the memory is locked.
+ *
+ * @var heappinned_t::lock_error
+ * errno of the failed mlock() when the memory is not locked, 0 otherwise.
+ */
+struct heappinned_t {
+    void *mapping;
+    size_t length;
+    uint8_t *base;
+    uint32_t block;
+    uint32_t nblocks;
+    uint32_t *runs;
+    bool locked;
+    int lock_error;
+};
+
+#define HEAP_DIO_BLOCK 4096
+
+/**
+ * @brief Maps and locks a heap of block-aligned buffers.
+ *
+ * @param heap Pointer to the heappinned_t structure to be initialized.
+ * @param size Size of the heap's memory in bytes, rounded up to whole blocks.
+ * @param block Block size in bytes, a power of two; 0 selects HEAP_DIO_BLOCK.
+ * @return 0 if the memory is locked, 1 if locking failed and the heap fell back to
+ *         pageable memory (see lock_error), -1 if the memory could not be mapped.
+ */
+int heap_pinned_init(struct heappinned_t *heap, size_t size, uint32_t block) {
+    memset(heap, 0, sizeof(*heap));
+    if (block == 0) {
+        block = HEAP_DIO_BLOCK;
+    }
+    if ((block & (block - 1)) != 0 || size == 0) {
+        return -1;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t slack = block > page ? block - page : 0;
+    heap->block = block;
+    heap->nblocks = (uint32_t)((size + block - 1) / block);
+    size_t data = (size_t)heap->nblocks * block;
+    heap->length = (slack + data + heap->nblocks * sizeof(uint32_t) + page - 1) & ~(page - 1);
+
+    heap->mapping = mmap(NULL, heap->length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (heap->mapping == MAP_FAILED) {
+        heap->mapping = NULL;
+        return -1;
+    }
+    heap->base = (uint8_t *)(((uintptr_t)heap->mapping + block - 1) & ~(uintptr_t)(block - 1));
+    heap->runs = (uint32_t *)(heap->base + data);
+
+    if (mlock(heap->mapping, heap->length) != 0) {
+        heap->lock_error = errno; // ENOMEM/EAGAIN: RLIMIT_MEMLOCK, EPERM: not allowed
+        return 1;
+    }
+    heap->locked = true;
+    return 0;
+}
+
+/**
+ * @brief Allocates a block-aligned buffer from a pinned heap.
+ *
+ * @param heap Pointer to the pinned heap.
+ * @param size The size of the buffer in bytes, rounded up to whole blocks.
+ * @return A pointer to the buffer, or NULL if no run of free blocks is large enough.
+ */
+void *heap_pinned_alloc(struct heappinned_t *heap, size_t size) {
+    uint32_t need = (uint32_t)((size + heap->block - 1) / heap->block);
+    if (need == 0) {
+        need = 1;
+    }
+    uint32_t start = 0, found = 0;
+    for (uint32_t i = 0; i < heap->nblocks;) {
+        if (heap->runs[i] != 0) {
+            i += heap->runs[i];
+            found = 0;
+            continue;
+        }
+        if (found++ == 0) {
+            start = i;
+        }
+        if (found == need) {
+            heap->runs[start] = need;
+            return heap->base + (size_t)start * heap->block;
+        }
+        i++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Frees a buffer allocated from a pinned heap.
+ *
+ * @param heap Pointer to the pinned heap.
+ * @param ptr A pointer to the buffer to be freed. If NULL, the function does nothing.
+ */
+void heap_pinned_free(struct heappinned_t *heap, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    heap->runs[((uint8_t *)ptr - heap->base) / heap->block] = 0;
+}
+
+/**
+ * @brief Unlocks and unmaps a pinned heap.
+ *
+ * @param heap Pointer to the pinned heap.
+ */
+void heap_pinned_destroy(struct heappinned_t *heap) {
+    if (heap->mapping != NULL) {
+        if (heap->locked) {
+            munlock(heap->mapping, heap->length);
+        }
+        munmap(heap->mapping, heap->length);
+    }
+    memset(heap, 0, sizeof(*heap));
+}
+
+/**
+ * @struct heapseg_t
+ * @brief Header of one segment of a buffer chain, followed by its data.
+ *
+ * @var heapseg_t::next
+ * Pointer to the next segment of the chain.
+ *
+ * @var heapseg_t::len
+ * Number of bytes used in the segment.
+ */
+struct heapseg_t {
+    struct heapseg_t *next;
+    uint32_t len;
+};
+
+/**
+ * @struct heapchain_t
+ * @brief A buffer built from fixed-size heap segments, for vectored I/O.
+ *
+ * Data is appended to the last segment and a new segment is allocated when it is full,
+ * so building a large buffer never copies what was already written. heap_chain_iov()
+ * exposes the segments as an iovec array for writev(), sendmsg() or io_uring.
+ *
+ * @var heapchain_t::heap
+ * The heap segments are allocated from.
+ *
+ * @var heapchain_t::seg_size
+ * Data capacity of a segment in bytes.
+ *
+ * @var heapchain_t::first
+ * Pointer to the first segment, or NULL.
+ *
+ * @var heapchain_t::last
+ * Pointer to the last segment, or NULL.
+ *
+ * @var heapchain_t::count
+ * Number of segments.
+ *
+ * @var heapchain_t::length
+ * Total number of bytes in the chain.
+ */
+struct heapchain_t {
+    struct heapinfo_t *heap;
+    uint32_t seg_size;
+    struct heapseg_t *first;
+    struct heapseg_t *last;
+    uint32_t count;
+    size_t length;
+};
+
+/**
+ * @brief Initializes an empty buffer chain.
+ *
+ * @param chain Pointer to the heapchain_t structure to be initialized.
+ * @param heap The heap segments are allocated from.
+ * @param seg_size Data capacity of a segment in bytes.
+ */
+void heap_chain_init(struct heapchain_t *chain, struct heapinfo_t *heap, uint32_t seg_size) {
+    chain->heap = heap;
+    chain->seg_size = ALIGN(seg_size);
+    chain->first = NULL;
+    chain->last = NULL;
+    chain->count = 0;
+    chain->length = 0;
+}
+
+/**
+ * @brief Appends a new, empty segment to a buffer chain.
+ */
+static struct heapseg_t *heap_chain_grow(struct heapchain_t *chain) {
+    struct heapseg_t *seg = heap_alloc(chain->heap, sizeof(struct heapseg_t) + chain->seg_size);
+    if (seg == NULL) {
+        return NULL;
+    }
+    seg->next = NULL;
+    seg->len = 0;
+    if (chain->last != NULL) {
+        chain->last->next = seg;
+    } else {
+        chain->first = seg;
+    }
+    chain->last = seg;
+    chain->count++;
+    return seg;
+}
+
+/**
+ * @brief Reserves contiguous space at the end of a buffer chain.
+ *
+ * The space is counted as appended and can be written in place. If the last segment
+ * lacks room, a new segment is started and the rest of the last one stays unused.
+ *
+ * @param chain Pointer to the buffer chain.
+ * @param len Number of bytes to reserve, at most `seg_size`.
+ * @return A pointer to the reserved space, or NULL if `len` is too large or the heap is exhausted.
+ */
+void *heap_chain_reserve(struct heapchain_t *chain, uint32_t len) {
+    if (len > chain->seg_size) {
+        return NULL;
+    }
+    struct heapseg_t *seg = chain->last;
+    if (seg == NULL || chain->seg_size - seg->len < len) {
+        if ((seg = heap_chain_grow(chain)) == NULL) {
+            return NULL;
+        }
+    }
+    void *ptr = (uint8_t *)(seg + 1) + seg->len;
+    seg->len += len;
+    chain->length += len;
+    return ptr;
+}
+
+/**
+ * @brief Copies data to the end of a buffer chain, across as many segments as needed.
+ *
+ * @param chain Pointer to the buffer chain.
+ * @param data The data to append.
+ * @param len Number of bytes to append.
+ * @return 0 on success, -1 if the heap is exhausted; the bytes appended so far are kept.
+ */
+int heap_chain_append(struct heapchain_t *chain, const void *data, size_t len) {
+    const uint8_t *src = data;
+    while (len > 0) {
+        struct heapseg_t *seg = chain->last;
+        if (seg == NULL || seg->len == chain->seg_size) {
+            if ((seg = heap_chain_grow(chain)) == NULL) {
+                return -1;
+            }
+        }
+        uint32_t room = chain->seg_size - seg->len;
+        uint32_t n = len < room ? (uint32_t)len : room;
+        memcpy((uint8_t *)(seg + 1) + seg->len, src, n);
+        seg->len += n;
+        chain->length += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Describes the segments of a buffer chain as an iovec array.
+ *
+ * Empty segments are skipped.
+ *
+ * @param chain Pointer to the buffer chain.
+ * @param iov The array to fill.
+ * @param max Number of entries in `iov`.
+ * @return The number of entries filled, at most `max`.
+ */
+uint32_t heap_chain_iov(struct heapchain_t *chain, struct iovec *iov, uint32_t max) {
+    uint32_t n = 0;
+    for (struct heapseg_t *seg = chain->first; seg != NULL && n < max; seg = seg->next) {
+        if (seg->len > 0) {
+            iov[n].iov_base = seg + 1;
+            iov[n].iov_len = seg->len;
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Frees every segment of a buffer chain and leaves it empty.
+ *
+ * @param chain Pointer to the buffer chain.
+ */
+void heap_chain_free(struct heapchain_t *chain) {
+    struct heapseg_t *seg = chain->first;
+    while (seg != NULL) {
+        struct heapseg_t *next = seg->next;
+        heap_free(chain->heap, seg);
+        seg = next;
+    }
+    chain->first = NULL;
+    chain->last = NULL;
+    chain->count = 0;
+    chain->length = 0;
+}
+
+/**
+ * @struct heapvbuf_t
+ * @brief A growable buffer whose address never changes.
+ *
+ * The buffer reserves its maximum size of address space up front, without memory behind
+ * it, and commits pages only as it grows. Growing therefore never moves or copies the
+ * data, unlike heap_realloc(), and shrinking returns the pages past the new size.
+ *
+ * @var heapvbuf_t::base
+ * Start of the buffer; stays the same for the buffer's lifetime.
+ *
+ * @var heapvbuf_t::reserved
+ * Bytes of address space reserved, the maximum size.
+ *
+ * @var heapvbuf_t::committed
+ * Bytes currently accessible, `size` rounded up to whole pages.
+ *
+ * @var heapvbuf_t::size
+ * Current size of the buffer in bytes.
+ */
+struct heapvbuf_t {
+    uint8_t *base;
+    size_t reserved;
+    size_t committed;
+    size_t size;
+};
+
+/**
+ * @brief Reserves address space for a growable buffer.
+ *
+ * @param buf Pointer to the heapvbuf_t structure to be initialized.
+ * @param max Maximum size of the buffer in bytes.
+ * @return 0 on success, -1 if the address space could not be reserved.
+ */
+int heap_vbuf_init(struct heapvbuf_t *buf, size_t max) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    buf->reserved = (max + page - 1) & ~(page - 1);
+    buf->committed = 0;
+    buf->size = 0;
+    void *memory = mmap(NULL, buf->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        buf->base = NULL;
+        return -1;
+    }
+    buf->base = memory;
+    return 0;
+}
+
+/**
+ * @brief Grows or shrinks a growable buffer in place.
+ *
+ * Growing commits the pages needed and keeps the contents. Shrinking discards the pages
+ * past the new size, returning them to the OS; their contents are lost.
+ *
+ * @param buf Pointer to the growable buffer.
+ * @param size The new size of the buffer in bytes, at most the reserved size.
+ * @return 0 on success, -1 if `size` exceeds the reservation or the pages could not be committed.
+ */
+int heap_vbuf_resize(struct heapvbuf_t *buf, size_t size) {
+    if (size > buf->reserved) {
+        return -1;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t commit = (size + page - 1) & ~(page - 1);
+    if (commit > buf->committed) {
+        if (mprotect(buf->base + buf->committed, commit - buf->committed, PROT_READ | PROT_WRITE) != 0) {
+            return -1;
+        }
+    } else if (commit < buf->committed) {
+        madvise(buf->base + commit, buf->committed - commit, MADV_DONTNEED);
+        mprotect(buf->base + commit, buf->committed - commit, PROT_NONE);
+    }
+    buf->committed = commit;
+    buf->size = size;
+    return 0;
+}
+
+/**
+ * @brief Releases a growable buffer and its address space.
+ *
+ * @param buf Pointer to the growable buffer.
+ */
+void heap_vbuf_destroy(struct heapvbuf_t *buf) {
+    if (buf->base != NULL) {
+        munmap(buf->base, buf->reserved);
+    }
+    buf->base = NULL;
+    buf->reserved = 0;
+    buf->committed = 0;
+    buf->size = 0;
+}
+
+/**
+ * @brief Largest piece of a free chunk heap_zero_idle() claims at once, and the budget
+ *        of each round of the heapzeroer_t worker.
+ */
+#define HEAP_ZERO_BUDGET (1u << 20)
+
+/**
+ * @brief Whether heap_zero_idle() should clear a free chunk.
+ *
+ * @param prev The chunk before `chunk` in the list, or NULL.
+ * @param chunk The chunk to consider.
+ */
+static bool heap_zero_wanted(struct heapchunk_t *prev, struct heapchunk_t *chunk) {
+    if (chunk->inuse || (chunk->flags & HEAP_CHUNK_ZEROED)) {
+        return false;
+    }
+    if (chunk->size >= HEAP_ZERO_MIN) {
+        return true;
+    }
+    struct heapchunk_t *next = chunk->next;
+    return (prev != NULL && !prev->inuse && (prev->flags & HEAP_CHUNK_ZEROED) && heap_adjacent(prev, chunk)) ||
+           (next != NULL && !next->inuse && (next->flags & HEAP_CHUNK_ZEROED) && heap_adjacent(chunk, next));
+}
+
+/**
+ * @brief Zeroes free chunks ahead of time, for heap_alloc_zeroed().
+ *
+ * Free chunks not yet known to be zero are cleared if they hold at least HEAP_ZERO_MIN
+ * bytes or border a zeroed chunk, which they then coalesce with. They are cleared a
+ * piece of at most HEAP_ZERO_BUDGET bytes at a time. The piece is split off and marked
+ * in use, so the rest of the chunk stays available, cleared with `lock` released, then
+ * put back free, flagged HEAP_CHUNK_ZEROED and coalesced with the zeroed pieces before
+ * it. Meant to run from an idle loop or from the heapzeroer_t worker. Blocks queued by
+ * heap_release() are freed first.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @param lock The mutex serializing every operation on `heap`, or NULL if the heap is
+ *             only used by the calling thread.
+ * @param budget Stop once at least this many bytes were zeroed.
+ * @return The number of bytes zeroed; 0 when no chunk needs zeroing.
+ */
+size_t heap_zero_idle(struct heapinfo_t *heap, pthread_mutex_t *lock, size_t budget) {
+    size_t zeroed = 0;
+    while (zeroed < budget) {
+        if (lock != NULL) {
+            pthread_mutex_lock(lock);
+        }
+        heap_drain(heap);
+        struct heapchunk_t *prev = NULL;
+        struct heapchunk_t *chunk = heap->start;
+        while (chunk != NULL && !heap_zero_wanted(prev, chunk)) {
+            prev = chunk;
+            chunk = chunk->next;
+        }
+        if (chunk != NULL) {
+            // Claimed: neither allocated nor coalesced meanwhile
+            chunk = heap_take_low(chunk, chunk->size < HEAP_ZERO_BUDGET ? chunk->size : HEAP_ZERO_BUDGET);
+        }
+        if (lock != NULL) {
+            pthread_mutex_unlock(lock);
+        }
+        if (chunk == NULL) {
+            break;
+        }
+
+        heap_bulk_zero(chunk + 1, chunk->size);
+        zeroed += chunk->size;
+
+        if (lock != NULL) {
+            pthread_mutex_lock(lock);
+        }
+        chunk->flags = HEAP_CHUNK_ZEROED;
+        chunk->inuse = false;
+        heap_coalesce(heap, false);
+        if (lock != NULL) {
+            pthread_mutex_unlock(lock);
+        }
+    }
+    return zeroed;
+}
+
+/**
+ * @struct heapzeroer_t
+ * @brief A background thread that zeroes a heap's free chunks while it is idle.
+ *
+ * @var heapzeroer_t::heap
+ * The heap being zeroed.
+ *
+ * @var heapzeroer_t::lock
+ * The mutex every thread takes around operations on `heap`.
+ *
+ * @var heapzeroer_t::thread
+ * The worker thread.
+ *
+ * @var heapzeroer_t::stop
+ * Set to ask the worker to exit.
+ */
+struct heapzeroer_t {
+    struct heapinfo_t *heap;
+    pthread_mutex_t *lock;
+    pthread_t thread;
+    _Atomic bool stop;
+};
+
+#define HEAP_ZERO_SLEEP_US 10000
+
+static void *heap_zeroer_main(void *arg) {
+    struct heapzeroer_t *zeroer = arg;
+    while (!atomic_load_explicit(&zeroer->stop, memory_order_relaxed)) {
+        if (heap_zero_idle(zeroer->heap, zeroer->lock, HEAP_ZERO_BUDGET) == 0) {
+            usleep(HEAP_ZERO_SLEEP_US);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts a background thread that zeroes the free chunks of a heap.
+ *
+ * The heap must be shared through `lock`: every other thread takes it around each
+ * heap operation for as long as the worker runs.
+ *
+ * @param zeroer Pointer to the heapzeroer_t structure to be initialized.
+ * @param heap The heap to zero.
+ * @param lock The mutex serializing operations on `heap`.
+ * @return 0 on success, or an error number if the thread could not be created.
+ */
+int heap_zeroer_start(struct heapzeroer_t *zeroer, struct heapinfo_t *heap, pthread_mutex_t *lock) {
+    zeroer->heap = heap;
+    zeroer->lock = lock;
+    atomic_init(&zeroer->stop, false);
+    return pthread_create(&zeroer->thread, NULL, heap_zeroer_main, zeroer);
+}
+
+/**
+ * @brief Stops a background zeroing thread and waits for it to exit.
+ *
+ * @param zeroer Pointer to the running zeroer.
+ */
+void heap_zeroer_stop(struct heapzeroer_t *zeroer) {
+    atomic_store_explicit(&zeroer->stop, true, memory_order_relaxed);
+    pthread_join(zeroer->thread, NULL);
+}
+
+/**
+ * @brief Runtime control and introspection by name.
+ *
+ * @details
+ * heap_ctl() reads and writes tuning knobs and statistics through dotted names, in the
+ * style of mallctl():
+ * - `opt.bulk_nt_min` (size_t, rw): size from which heap_bulk_zero/copy bypass the cache.
+ * - `opt.parallel_min` (size_t, rw): size from which they use the worker pool.
+ * - `opt.parallel_threads` (uint32_t, rw): size of the worker pool; writing restarts it.
+ * - `opt.predict` (bool, rw): lifetime prediction in heap_alloc().
+ * - `opt.lifetime_rate` (uint32_t, rw): lifetime sampling rate, see heap_lifetime_enable().
+ * - `stats.heaps` (uint32_t, r): number of registered heaps.
+ * - `stats.allocated`, `stats.free`, `stats.chunks` (size_t, r): sums over registered heaps.
+ * - `stats.allocs`, `stats.frees`, `stats.bytes_allocated`, `stats.bytes_freed` (uint64_t, r):
+ *   the counters of heap_stats(), over all heaps and threads.
+ * - `stats.active` (uint64_t, r): `stats.bytes_allocated` minus `stats.bytes_freed`.
+ * - `stats.lifetime.sampled`, `stats.lifetime.dropped` (uint64_t, r): see heap_lifetimes().
+ * - `heap.<i>.allocated`, `heap.<i>.free`, `heap.<i>.chunks` (size_t, r): per registered heap.
+ * - `heap.<i>.avail` (uint32_t, r): the heap's `avail` field.
+ * - `heap.<i>.trim` (size_t, action): runs heap_trim() on every call, read or written,
+ *   and returns the bytes released.
+ *
+ * Heaps are numbered by heap_register(). Reading heap statistics walks the chunk list,
+ * so, like every heap operation, it must not run concurrently with other operations on
+ * the same heap. The `opt.*` knobs may also be set at startup through the MYALLOC_CONF
+ * environment variable, as comma-separated `name:value` pairs, for example
+ * `MYALLOC_CONF=opt.bulk_nt_min:4194304,opt.predict:true`. There, `exporter.path:<path>`
+ * also starts the metrics exporter (see heap_exporter_start()) on `<path>`, with `%p`
+ * replaced by the process id, so a node agent can scrape any process without the
+ * application calling into the allocator.
+ */
+#define HEAP_CTL_MAX_HEAPS 64
+#define HEAP_CTL_ENV "MYALLOC_CONF"
+#define HEAP_CTL_EXPORTER_KEY "exporter.path"
+
+static int heap_exporter_autostart(const char *path);
+
+enum heap_ctl_type_t {
+    HEAP_CTL_BOOL,
+    HEAP_CTL_U32,
+    HEAP_CTL_SIZE,
+    HEAP_CTL_U64,
+    HEAP_CTL_ACTION,    // get() runs on every call, reading or writing; the result is a size_t
+};
+
+/**
+ * @struct heapctl_t
+ * @brief One entry of the heap_ctl() namespace.
+ *
+ * @var heapctl_t::name
+ * The name, without the `heap.<i>.` prefix for per-heap entries.
+ *
+ * @var heapctl_t::type
+ * The type of the value exchanged with the caller.
+ *
+ * @var heapctl_t::per_heap
+ * Whether the entry is reached as `heap.<i>.<name>`.
+ *
+ * @var heapctl_t::get
+ * Reads the value; `heap` is NULL for global entries.
+ *
+ * @var heapctl_t::set
+ * Writes the value, or NULL if the entry is read-only. Returns 0 or an error number.
+ */
+struct heapctl_t {
+    const char *name;
+    enum heap_ctl_type_t type;
+    bool per_heap;
+    uint64_t (*get)(struct heapinfo_t *heap);
+    int (*set)(uint64_t value);
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct heapinfo_t *heaps[HEAP_CTL_MAX_HEAPS];
+} heap_ctl_registry = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * @brief Makes a heap visible to heap_ctl() as `heap.<i>` and in the `stats.*` sums.
+ *
+ * @param heap A pointer to the heap information structure.
+ * @return The heap's index, or -1 if HEAP_CTL_MAX_HEAPS heaps are already registered.
+ */
+int heap_register(struct heapinfo_t *heap) {
+    int index = -1;
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        if (heap_ctl_registry.heaps[i] == heap) {
+            index = i;
+            break;
+        }
+        if (heap_ctl_registry.heaps[i] == NULL && index < 0) {
+            index = i;
+        }
+    }
+    if (index >= 0) {
+        heap_ctl_registry.heaps[index] = heap;
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+    return index;
+}
+
+/**
+ * @brief Removes a heap from heap_ctl(); its index may then be reused.
+ *
+ * @param heap A pointer to a registered heap.
+ */
+void heap_unregister(struct heapinfo_t *heap) {
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        if (heap_ctl_registry.heaps[i] == heap) {
+            heap_ctl_registry.heaps[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+}
+
+static uint64_t heap_ctl_allocated(struct heapinfo_t *heap) {
+    uint64_t total = 0;
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        total += chunk->inuse ? chunk->size : 0;
+    }
+    return total;
+}
+
+static uint64_t heap_ctl_free(struct heapinfo_t *heap) {
+    uint64_t total = 0;
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        total += chunk->inuse ? 0 : chunk->size;
+    }
+    return total;
+}
+
+static uint64_t heap_ctl_chunks(struct heapinfo_t *heap) {
+    uint64_t count = 0;
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        count++;
+    }
+    return count;
+}
+
+static uint64_t heap_ctl_avail(struct heapinfo_t *heap) {
+    return heap->avail;
+}
+
+static uint64_t heap_ctl_trim(struct heapinfo_t *heap) {
+    return heap_trim(heap, 0);
+}
+
+/**
+ * @brief Sums a per-heap statistic over the registered heaps.
+ */
+static uint64_t heap_ctl_sum(uint64_t (*stat)(struct heapinfo_t *heap)) {
+    uint64_t total = 0;
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        if (heap_ctl_registry.heaps[i] != NULL) {
+            total += stat(heap_ctl_registry.heaps[i]);
+        }
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+    return total;
+}
+
+static uint64_t heap_ctl_one(struct heapinfo_t *heap) {
+    (void)heap;
+    return 1;
+}
+
+static uint64_t heap_ctl_stats_heaps(struct heapinfo_t *heap) {
+    (void)heap;
+    return heap_ctl_sum(heap_ctl_one);
+}
+
+static uint64_t heap_ctl_stats_allocated(struct heapinfo_t *heap) {
+    (void)heap;
+    return heap_ctl_sum(heap_ctl_allocated);
+}
+
+static uint64_t heap_ctl_stats_free(struct heapinfo_t *heap) {
+    (void)heap;
+    return heap_ctl_sum(heap_ctl_free);
+}
+
+static uint64_t heap_ctl_stats_chunks(struct heapinfo_t *heap) {
+    (void)heap;
+    return heap_ctl_sum(heap_ctl_chunks);
+}
+
+static uint64_t heap_ctl_stats_allocs(struct heapinfo_t *heap) {
+    (void)heap;
+    struct heapstats_t stats;
+    heap_stats(&stats);
+    return stats.allocs;
+}
+
+static uint64_t heap_ctl_stats_frees(struct heapinfo_t *heap) {
+    (void)heap;
+    struct heapstats_t stats;
+    heap_stats(&stats);
+    return stats.frees;
+}
+
+static uint64_t heap_ctl_stats_bytes_allocated(struct heapinfo_t *heap) {
+    (void)heap;
+    struct heapstats_t stats;
+    heap_stats(&stats);
+    return stats.bytes_allocated;
+}
+
+static uint64_t heap_ctl_stats_bytes_freed(struct heapinfo_t *heap) {
+    (void)heap;
+    struct heapstats_t stats;
+    heap_stats(&stats);
+    return stats.bytes_freed;
+}
+
+static uint64_t heap_ctl_stats_active(struct heapinfo_t *heap) {
+    (void)heap;
+    struct heapstats_t stats;
+    heap_stats(&stats);
+    return stats.bytes_allocated - stats.bytes_freed;
+}
+
+static uint64_t heap_ctl_stats_lifetime_sampled(struct heapinfo_t *heap) {
+    (void)heap;
+    struct heaplifetimes_t lifetimes;
+    heap_lifetimes(&lifetimes);
+    return lifetimes.sampled;
+}
+
+static uint64_t heap_ctl_stats_lifetime_dropped(struct heapinfo_t *heap) {
+    (void)heap;
+    return atomic_load_explicit(&heap_lifetime.dropped, memory_order_relaxed);
+}
+
+static uint64_t heap_ctl_get_bulk_nt_min(struct heapinfo_t *heap) {
+    (void)heap;
+    return atomic_load_explicit(&heap_bulk_nt_min, memory_order_relaxed);
+}
+
+static int heap_ctl_set_bulk_nt_min(uint64_t value) {
+    atomic_store_explicit(&heap_bulk_nt_min, value, memory_order_relaxed);
+    return 0;
+}
+
+static uint64_t heap_ctl_get_parallel_min(struct heapinfo_t *heap) {
+    (void)heap;
+    return atomic_load_explicit(&heap_parallel_min, memory_order_relaxed);
+}
+
+static int heap_ctl_set_parallel_min(uint64_t value) {
+    atomic_store_explicit(&heap_parallel_min, value, memory_order_relaxed);
+    return 0;
+}
+
+static uint64_t heap_ctl_get_parallel_threads(struct heapinfo_t *heap) {
+    (void)heap;
+    return atomic_load_explicit(&heap_pool.nthreads, memory_order_relaxed);
+}
+
+static int heap_ctl_set_parallel_threads(uint64_t value) {
+    if (value > HEAP_PARALLEL_MAX_THREADS) {
+        return EINVAL;
+    }
+    heap_parallel_stop();
+    if (value > 0 && heap_parallel_start((uint32_t)value) != 0) {
+        return EAGAIN;
+    }
+    return 0;
+}
+
+static uint64_t heap_ctl_get_predict(struct heapinfo_t *heap) {
+    (void)heap;
+    return atomic_load_explicit(&heap_predict_enabled, memory_order_relaxed);
+}
+
+static int heap_ctl_set_predict(uint64_t value) {
+    heap_predict_enable(value != 0);
+    return 0;
+}
+
+static uint64_t heap_ctl_get_lifetime_rate(struct heapinfo_t *heap) {
+    (void)heap;
+    return atomic_load_explicit(&heap_lifetime.rate, memory_order_relaxed);
+}
+
+static int heap_ctl_set_lifetime_rate(uint64_t value) {
+    if (value > UINT32_MAX) {
+        return EINVAL;
+    }
+    heap_lifetime_enable((uint32_t)value);
+    return 0;
+}
+
+static const struct heapctl_t heap_ctl_entries[] = {
+    { "opt.bulk_nt_min", HEAP_CTL_SIZE, false, heap_ctl_get_bulk_nt_min, heap_ctl_set_bulk_nt_min },
+    { "opt.parallel_min", HEAP_CTL_SIZE, false, heap_ctl_get_parallel_min, heap_ctl_set_parallel_min },
+    { "opt.parallel_threads", HEAP_CTL_U32, false, heap_ctl_get_parallel_threads, heap_ctl_set_parallel_threads },
+    { "opt.predict", HEAP_CTL_BOOL, false, heap_ctl_get_predict, heap_ctl_set_predict },
+    { "opt.lifetime_rate", HEAP_CTL_U32, false, heap_ctl_get_lifetime_rate, heap_ctl_set_lifetime_rate },
+    { "stats.heaps", HEAP_CTL_U32, false, heap_ctl_stats_heaps, NULL },
+    { "stats.allocated", HEAP_CTL_SIZE, false, heap_ctl_stats_allocated, NULL },
+    { "stats.free", HEAP_CTL_SIZE, false, heap_ctl_stats_free, NULL },
+    { "stats.chunks", HEAP_CTL_SIZE, false, heap_ctl_stats_chunks, NULL },
+    { "stats.allocs", HEAP_CTL_U64, false, heap_ctl_stats_allocs, NULL },
+    { "stats.frees", HEAP_CTL_U64, false, heap_ctl_stats_frees, NULL },
+    { "stats.bytes_allocated", HEAP_CTL_U64, false, heap_ctl_stats_bytes_allocated, NULL },
+    { "stats.bytes_freed", HEAP_CTL_U64, false, heap_ctl_stats_bytes_freed, NULL },
+    { "stats.active", HEAP_CTL_U64, false, heap_ctl_stats_active, NULL },
+    { "stats.lifetime.sampled", HEAP_CTL_U64, false, heap_ctl_stats_lifetime_sampled, NULL },
+    { "stats.lifetime.dropped", HEAP_CTL_U64, false, heap_ctl_stats_lifetime_dropped, NULL },
+    { "allocated", HEAP_CTL_SIZE, true, heap_ctl_allocated, NULL },
+    { "free", HEAP_CTL_SIZE, true, heap_ctl_free, NULL },
+    { "chunks", HEAP_CTL_SIZE, true, heap_ctl_chunks, NULL },
+    { "avail", HEAP_CTL_U32, true, heap_ctl_avail, NULL },
+    { "trim", HEAP_CTL_ACTION, true, heap_ctl_trim, NULL },
+};
+
+#define HEAP_CTL_ENTRY_COUNT (sizeof(heap_ctl_entries) / sizeof(heap_ctl_entries[0]))
+
+static size_t heap_ctl_type_size(enum heap_ctl_type_t type) {
+    switch (type) {
+    case HEAP_CTL_BOOL:
+        return sizeof(bool);
+    case HEAP_CTL_U32:
+        return sizeof(uint32_t);
+    case HEAP_CTL_U64:
+        return sizeof(uint64_t);
+    default:
+        return sizeof(size_t);
+    }
+}
+
+/**
+ * @brief Resolves a name to its entry and, for `heap.<i>.*` names, to the heap.
+ *
+ * @return The entry, or NULL if the name or the heap index is unknown.
+ */
+static const struct heapctl_t *heap_ctl_lookup(const char *name, struct heapinfo_t **heap) {
+    bool per_heap = strncmp(name, "heap.", 5) == 0;
+    *heap = NULL;
+    if (per_heap) {
+        char *end;
+        unsigned long index = strtoul(name + 5, &end, 10);
+        if (end == name + 5 || *end != '.' || index >= HEAP_CTL_MAX_HEAPS) {
+            return NULL;
+        }
+        pthread_mutex_lock(&heap_ctl_registry.lock);
+        *heap = heap_ctl_registry.heaps[index];
+        pthread_mutex_unlock(&heap_ctl_registry.lock);
+        if (*heap == NULL) {
+            return NULL;
+        }
+        name = end + 1;
+    }
+    for (size_t i = 0; i < HEAP_CTL_ENTRY_COUNT; i++) {
+        if (heap_ctl_entries[i].per_heap == per_heap && strcmp(heap_ctl_entries[i].name, name) == 0) {
+            return &heap_ctl_entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads and optionally writes a value by name.
+ *
+ * The old value is read before the new one is written. Values are exchanged in the
+ * entry's own type, and the lengths must match it exactly. Actions such as
+ * `heap.<i>.trim` run on every call; `oldp` then receives their result.
+ *
+ * @param name The dotted name, e.g. "opt.bulk_nt_min" or "heap.0.allocated".
+ * @param oldp Receives the current value, or NULL to skip reading.
+ * @param oldlenp Points to the size of `oldp`; ignored when `oldp` is NULL.
+ * @param newp The value to write, or NULL to only read.
+ * @param newlen The size of `newp`.
+ * @return 0 on success, ENOENT for an unknown name, EINVAL for a length mismatch, EPERM
+ *         when writing a read-only entry, or the error of the write itself.
+ */
+int heap_ctl(const char *name, void *oldp, size_t *oldlenp, const void *newp, size_t newlen) {
+    struct heapinfo_t *heap;
+    const struct heapctl_t *entry = heap_ctl_lookup(name, &heap);
+    if (entry == NULL) {
+        return ENOENT;
+    }
+    size_t len = heap_ctl_type_size(entry->type);
+    if ((oldp != NULL && (oldlenp == NULL || *oldlenp != len)) || (newp != NULL && newlen != len)) {
+        return EINVAL;
+    }
+    if (newp != NULL && entry->set == NULL && entry->type != HEAP_CTL_ACTION) {
+        return EPERM;
+    }
+    if (oldp != NULL || entry->type == HEAP_CTL_ACTION) {
+        uint64_t value = entry->get(heap);
+        if (oldp != NULL) {
+            switch (entry->type) {
+            case HEAP_CTL_BOOL:
+                *(bool *)oldp = value != 0;
+                break;
+            case HEAP_CTL_U32:
+                *(uint32_t *)oldp = (uint32_t)value;
+                break;
+            case HEAP_CTL_U64:
+                *(uint64_t *)oldp = value;
+                break;
+            default:
+                *(size_t *)oldp = (size_t)value;
+                break;
+            }
+        }
+    }
+    if (newp != NULL && entry->set != NULL) {
+        switch (entry->type) {
+        case HEAP_CTL_BOOL:
+            return entry->set(*(const bool *)newp);
+        case HEAP_CTL_U32:
+            return entry->set(*(const uint32_t *)newp);
+        case HEAP_CTL_U64:
+            return entry->set(*(const uint64_t *)newp);
+        default:
+            return entry->set(*(const size_t *)newp);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies the `opt.*` settings from the MYALLOC_CONF environment variable at startup.
+ *
+ * Values are numbers in any base strtoull() accepts, or `true` and `false`, except for
+ * `exporter.path`, whose value is a socket path. Invalid pairs are reported on stderr
+ * and skipped.
+ */
+__attribute__((constructor)) static void heap_ctl_configure(void) {
+    const char *conf = getenv(HEAP_CTL_ENV);
+    if (conf == NULL) {
+        return;
+    }
+    char pair[128];
+    while (*conf != '\0') {
+        size_t n = strcspn(conf, ",");
+        if (n > 0 && n < sizeof(pair)) {
+            memcpy(pair, conf, n);
+            pair[n] = '\0';
+            char *value = strchr(pair, ':');
+            struct heapinfo_t *heap;
+            const struct heapctl_t *entry = NULL;
+            if (value != NULL && strncmp(pair, HEAP_CTL_EXPORTER_KEY ":", sizeof(HEAP_CTL_EXPORTER_KEY)) == 0) {
+                if (heap_exporter_autostart(value + 1) != 0) {
+                    fprintf(stderr, "%s: cannot serve metrics on \"%s\": %s\n", HEAP_CTL_ENV, value + 1,
+                            strerror(errno));
+                }
+                conf += n;
+                conf += *conf == ',';
+                continue;
+            }
+            if (value != NULL && strncmp(pair, "opt.", 4) == 0) {
+                *value++ = '\0';
+                entry = heap_ctl_lookup(pair, &heap);
+            }
+            char *end = NULL;
+            uint64_t number = 0;
+            if (entry != NULL && entry->set != NULL) {
+                if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+                    number = value[0] == 't';
+                    end = value + strlen(value);
+                } else {
+                    number = strtoull(value, &end, 0);
+                }
+            }
+            if (end == NULL || end == value || *end != '\0' || entry->set(number) != 0) {
+                fprintf(stderr, "%s: invalid setting \"%.*s\"\n", HEAP_CTL_ENV, (int)n, conf);
+            }
+        } else if (n > 0) {
+            fprintf(stderr, "%s: invalid setting \"%.*s\"\n", HEAP_CTL_ENV, (int)n, conf);
+        }
+        conf += n;
+        conf += *conf == ',';
+    }
+}
+
+/**
+ * @struct heapmallinfo_t
+ * @brief Memory usage of the registered heaps, laid out like glibc's `struct mallinfo2`.
+ *
+ * Fields glibc uses for fastbins and mmapped chunks are always 0 here.
+ *
+ * @var heapmallinfo_t::arena
+ * Bytes of heap memory, chunk headers included.
+ *
+ * @var heapmallinfo_t::ordblks
+ * Number of free chunks.
+ *
+ * @var heapmallinfo_t::uordblks
+ * Bytes in allocated blocks.
+ *
+ * @var heapmallinfo_t::fordblks
+ * Bytes in free chunks.
+ *
+ * @var heapmallinfo_t::keepcost
+ * Size of the free chunk at the end of each heap, which heap_trim() can release.
+ */
+struct heapmallinfo_t {
+    size_t arena;
+    size_t ordblks;
+    size_t smblks;
+    size_t hblks;
+    size_t hblkhd;
+    size_t usmblks;
+    size_t fsmblks;
+    size_t uordblks;
+    size_t fordblks;
+    size_t keepcost;
+};
+
+#define HEAP_INFO_BINS 32
+
+static void heap_mallinfo_add(struct heapinfo_t *heap, struct heapmallinfo_t *info) {
+    for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+        info->arena += sizeof(struct heapchunk_t) + chunk->size;
+        if (chunk->inuse) {
+            info->uordblks += chunk->size;
+            continue;
+        }
+        info->ordblks++;
+        info->fordblks += chunk->size;
+        if (chunk->next == NULL) {
+            info->keepcost += chunk->size;
+        }
+    }
+}
+
+/**
+ * @brief Reports the memory usage of the registered heaps, like glibc's mallinfo2().
+ *
+ * @return The usage summed over every heap registered with heap_register().
+ */
+struct heapmallinfo_t heap_mallinfo2(void) {
+    struct heapmallinfo_t info = {0};
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        if (heap_ctl_registry.heaps[i] != NULL) {
+            heap_mallinfo_add(heap_ctl_registry.heaps[i], &info);
+        }
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+    return info;
+}
+
+/**
+ * @brief Prints the usage of each registered heap and the totals, like glibc's malloc_stats().
+ *
+ * @param fp The stream to print to; glibc prints to stderr.
+ */
+void heap_malloc_stats(FILE *fp) {
+    struct heapmallinfo_t total = {0};
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        if (heap_ctl_registry.heaps[i] == NULL) {
+            continue;
+        }
+        struct heapmallinfo_t info = {0};
+        heap_mallinfo_add(heap_ctl_registry.heaps[i], &info);
+        fprintf(fp, "Arena %d:\n", i);
+        fprintf(fp, "system bytes     = %10zu\n", info.arena);
+        fprintf(fp, "in use bytes     = %10zu\n", info.uordblks);
+        heap_mallinfo_add(heap_ctl_registry.heaps[i], &total);
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+    fprintf(fp, "Total (incl. mmap):\n");
+    fprintf(fp, "system bytes     = %10zu\n", total.arena);
+    fprintf(fp, "in use bytes     = %10zu\n", total.uordblks);
+    fprintf(fp, "max mmap regions = %10d\n", 0);
+    fprintf(fp, "max mmap bytes   = %10d\n", 0);
+}
+
+/**
+ * @brief Returns the free memory of every registered heap to the system, like glibc's malloc_trim().
+ *
+ * @param pad Bytes to keep resident at the end of each heap.
+ * @return 1 if any memory was released, 0 otherwise.
+ */
+int heap_malloc_trim(size_t pad) {
+    size_t released = 0;
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        if (heap_ctl_registry.heaps[i] != NULL) {
+            released += heap_trim(heap_ctl_registry.heaps[i], pad);
+        }
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+    return released > 0;
+}
+
+/**
+ * @brief Writes the registered heaps' state as XML, in the format of glibc's malloc_info().
+ *
+ * Free chunks are listed in power-of-two size ranges and all count as "rest"; there are
+ * no fastbins or mmapped chunks.
+ *
+ * @param options Must be 0.
+ * @param fp The stream to write to.
+ * @return 0 on success, or -1 with errno set to EINVAL if `options` is not 0.
+ */
+int heap_malloc_info(int options, FILE *fp) {
+    if (options != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct heapmallinfo_t total = {0};
+    fprintf(fp, "<malloc version=\"1\">\n");
+    pthread_mutex_lock(&heap_ctl_registry.lock);
+    for (int i = 0; i < HEAP_CTL_MAX_HEAPS; i++) {
+        struct heapinfo_t *heap = heap_ctl_registry.heaps[i];
+        if (heap == NULL) {
+            continue;
+        }
+        size_t count[HEAP_INFO_BINS] = {0};
+        size_t bytes[HEAP_INFO_BINS] = {0};
+        for (struct heapchunk_t *chunk = heap->start; chunk != NULL; chunk = chunk->next) {
+            if (!chunk->inuse) {
+                uint32_t bin = chunk->size != 0 ? 31 - __builtin_clz(chunk->size) : 0;
+                count[bin]++;
+                bytes[bin] += chunk->size;
+            }
+        }
+        struct heapmallinfo_t info = {0};
+        heap_mallinfo_add(heap, &info);
+        heap_mallinfo_add(heap, &total);
+
+        fprintf(fp, "<heap nr=\"%d\">\n<sizes>\n", i);
+        for (uint32_t bin = 0; bin < HEAP_INFO_BINS; bin++) {
+            if (count[bin] != 0) {
+                fprintf(fp, "  <size from=\"%zu\" to=\"%zu\" total=\"%zu\" count=\"%zu\"/>\n",
+                        (size_t)1 << bin, ((size_t)2 << bin) - 1, bytes[bin], count[bin]);
+            }
+        }
+        fprintf(fp, "</sizes>\n");
+        fprintf(fp, "<total type=\"fast\" count=\"0\" size=\"0\"/>\n");
+        fprintf(fp, "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n", info.ordblks, info.fordblks);
+        fprintf(fp, "<system type=\"current\" size=\"%zu\"/>\n", info.arena);
+        fprintf(fp, "<system type=\"max\" size=\"%zu\"/>\n", info.arena);
+        fprintf(fp, "<aspace type=\"total\" size=\"%zu\"/>\n", info.arena);
+        fprintf(fp, "<aspace type=\"mprotect\" size=\"%zu\"/>\n", info.arena);
+        fprintf(fp, "</heap>\n");
+    }
+    pthread_mutex_unlock(&heap_ctl_registry.lock);
+    fprintf(fp, "<total type=\"fast\" count=\"0\" size=\"0\"/>\n");
+    fprintf(fp, "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n", total.ordblks, total.fordblks);
+    fprintf(fp, "<total type=\"mmap\" count=\"0\" size=\"0\"/>\n");
+    fprintf(fp, "<system type=\"current\" size=\"%zu\"/>\n", total.arena);
+    fprintf(fp, "<system type=\"max\" size=\"%zu\"/>\n", total.arena);
+    fprintf(fp, "<aspace type=\"total\" size=\"%zu\"/>\n", total.arena);
+    fprintf(fp, "<aspace type=\"mprotect\" size=\"%zu\"/>\n", total.arena);
+    fprintf(fp, "</malloc>\n");
+    return 0;
+}
+
+#ifdef HEAP_GLIBC_COMPAT
+/**
+ * @brief glibc-named entry points, for programs and tools that call them directly.
+ *
+ * Define HEAP_GLIBC_COMPAT when this allocator replaces glibc's malloc, so that
+ * monitoring agents and runbooks calling these functions see the heaps registered here.
+ */
+_Static_assert(sizeof(struct mallinfo2) == sizeof(struct heapmallinfo_t), "heapmallinfo_t must mirror struct mallinfo2");
+
+struct mallinfo2 mallinfo2(void) {
+    struct heapmallinfo_t info = heap_mallinfo2();
+    struct mallinfo2 result;
+    memcpy(&result, &info, sizeof(result));
+    return result;
+}
+
+void malloc_stats(void) {
+    heap_malloc_stats(stderr);
+}
+
+int malloc_trim(size_t pad) {
+    return heap_malloc_trim(pad);
+}
+
+int malloc_info(int options, FILE *fp) {
+    return heap_malloc_info(options, fp);
+}
+
+#endif
+
+/**
+ * @brief Metrics exporter on a Unix domain socket.
+ *
+ * @details
+ * heap_exporter_start() runs a thread that answers every connection to a Unix socket
+ * with the output of heap_metrics_write(): the heap_stats() counters, the per-class
+ * allocation counts and occupancy, the lifetime histograms of heap_lifetimes() once
+ * sampling is on, and the slow-path totals when telemetry is on. In JSON, bucket `b`
+ * of a lifetime histogram counts lifetimes of 2^b to 2^(b+1) - 1 ns.
+ * Only lock-free counters are read, so scraping never stops or races the allocator.
+ *
+ * A client may send nothing and just read the default format, send a line starting
+ * with `json` or `prometheus`, or send an HTTP request: `GET /json` returns JSON and
+ * any other path the Prometheus text format, with HTTP headers, so that
+ * `curl --unix-socket <path> http://localhost/metrics` works.
+ *
+ * Clients are served one at a time, each given at most HEAP_EXPORTER_REQUEST_MS to send
+ * its request and HEAP_EXPORTER_SEND_MS per send of the answer, so a client that never
+ * reads cannot stall the exporter.
+ */
+#define HEAP_EXPORTER_BACKLOG 16
+#define HEAP_EXPORTER_POLL_MS 200
+#define HEAP_EXPORTER_REQUEST_MS 100
+#define HEAP_EXPORTER_SEND_MS 1000
+
+enum heap_metrics_format_t {
+    HEAP_METRICS_PROMETHEUS,
+    HEAP_METRICS_JSON,
+};
+
+/**
+ * @struct heapexporter_t
+ * @brief A thread serving metrics on a Unix domain socket.
+ *
+ * @var heapexporter_t::fd
+ * The listening socket.
+ *
+ * @var heapexporter_t::format
+ * Format sent to clients that do not ask for one.
+ *
+ * @var heapexporter_t::thread
+ * The serving thread.
+ *
+ * @var heapexporter_t::stop
+ * Set to ask the thread to exit.
+ *
+ * @var heapexporter_t::path
+ * The socket path, removed when the exporter stops.
+ */
+struct heapexporter_t {
+    int fd;
+    enum heap_metrics_format_t format;
+    pthread_t thread;
+    _Atomic bool stop;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+};
+
+static void heap_metrics_class_label(char *label, size_t len, uint32_t index) {
+    uint64_t size = heap_stats_class_size(index);
+    if (size == UINT64_MAX) {
+        snprintf(label, len, "+Inf");
+    } else {
+        snprintf(label, len, "%llu", (unsigned long long)size);
+    }
+}
+
+static void heap_metrics_prometheus(FILE *fp, const struct heapstats_t *stats, const struct heaplifetimes_t *lifetimes,
+                                    const struct heaptelemetry_t *region) {
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+    } totals[] = {
+        { "myalloc_allocs_total", "counter", "Blocks allocated." },
+        { "myalloc_frees_total", "counter", "Blocks freed." },
+        { "myalloc_allocated_bytes_total", "counter", "Usable bytes allocated." },
+        { "myalloc_freed_bytes_total", "counter", "Usable bytes freed." },
+        { "myalloc_active_bytes", "gauge", "Usable bytes in allocated blocks." },
+    };
+    uint64_t values[] = {
+        stats->allocs, stats->frees, stats->bytes_allocated, stats->bytes_freed,
+        stats->bytes_allocated - stats->bytes_freed,
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", totals[i].name, totals[i].help,
+                totals[i].name, totals[i].type, totals[i].name, (unsigned long long)values[i]);
+    }
+
+    static const char *classes[][3] = {
+        { "myalloc_class_allocs_total", "counter", "Blocks allocated, by size class upper bound." },
+        { "myalloc_class_frees_total", "counter", "Blocks freed, by size class upper bound." },
+        { "myalloc_class_active_blocks", "gauge", "Allocated blocks, by size class upper bound." },
+    };
+    for (size_t m = 0; m < 3; m++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", classes[m][0], classes[m][2], classes[m][0], classes[m][1]);
+        for (uint32_t i = 0; i < HEAP_STATS_CLASSES; i++) {
+            if (stats->class_allocs[i] == 0) {
+                continue;
+            }
+            uint64_t value = m == 0 ? stats->class_allocs[i] : m == 1 ? stats->class_frees[i]
+                                                                      : stats->class_allocs[i] - stats->class_frees[i];
+            char label[24];
+            heap_metrics_class_label(label, sizeof(label), i);
+            fprintf(fp, "%s{size=\"%s\"} %llu\n", classes[m][0], label, (unsigned long long)value);
+        }
+    }
+
+    if (lifetimes->sampled != 0) {
+        fprintf(fp, "# HELP myalloc_lifetime_seconds Lifetimes of sampled blocks, by size class upper bound.\n"
+                    "# TYPE myalloc_lifetime_seconds histogram\n");
+        for (uint32_t i = 0; i < HEAP_STATS_CLASSES; i++) {
+            char label[24];
+            heap_metrics_class_label(label, sizeof(label), i);
+            uint64_t count = 0;
+            for (uint32_t b = 0; b < HEAP_LIFETIME_BUCKETS; b++) {
+                count += lifetimes->counts[i][b];
+            }
+            if (count == 0) {
+                continue;
+            }
+            uint64_t cumulative = 0;
+            for (uint32_t b = 0; b + 1 < HEAP_LIFETIME_BUCKETS; b++) {
+                cumulative += lifetimes->counts[i][b];
+                fprintf(fp, "myalloc_lifetime_seconds_bucket{size=\"%s\",le=\"%.9g\"} %llu\n", label,
+                        (double)((uint64_t)2 << b) / 1e9, (unsigned long long)cumulative);
+            }
+            fprintf(fp, "myalloc_lifetime_seconds_bucket{size=\"%s\",le=\"+Inf\"} %llu\n", label,
+                    (unsigned long long)count);
+            fprintf(fp, "myalloc_lifetime_seconds_sum{size=\"%s\"} %.9f\n", label, (double)lifetimes->sum_ns[i] / 1e9);
+            fprintf(fp, "myalloc_lifetime_seconds_count{size=\"%s\"} %llu\n", label, (unsigned long long)count);
+        }
+        fprintf(fp, "# HELP myalloc_lifetime_dropped_total Lifetime samples skipped for lack of a free slot.\n"
+                    "# TYPE myalloc_lifetime_dropped_total counter\nmyalloc_lifetime_dropped_total %llu\n",
+                (unsigned long long)lifetimes->dropped);
+    }
+
+    if (region != NULL) {
+        fprintf(fp, "# HELP myalloc_grows_total Extents child heaps took from their parents.\n"
+                    "# TYPE myalloc_grows_total counter\nmyalloc_grows_total %llu\n",
+                (unsigned long long)atomic_load_explicit(&region->grows, memory_order_relaxed));
+        fprintf(fp, "# HELP myalloc_failures_total Allocations that found no memory.\n"
+                    "# TYPE myalloc_failures_total counter\nmyalloc_failures_total %llu\n",
+                (unsigned long long)atomic_load_explicit(&region->failures, memory_order_relaxed));
+        fprintf(fp, "# HELP myalloc_trimmed_bytes_total Bytes returned to the system by heap_trim().\n"
+                    "# TYPE myalloc_trimmed_bytes_total counter\nmyalloc_trimmed_bytes_total %llu\n",
+                (unsigned long long)atomic_load_explicit(&region->bytes_trimmed, memory_order_relaxed));
+    }
+}
+
+static void heap_metrics_json(FILE *fp, const struct heapstats_t *stats, const struct heaplifetimes_t *lifetimes,
+                              const struct heaptelemetry_t *region) {
+    fprintf(fp, "{\"allocs\":%llu,\"frees\":%llu,\"bytes_allocated\":%llu,\"bytes_freed\":%llu,\"active_bytes\":%llu",
+            (unsigned long long)stats->allocs, (unsigned long long)stats->frees,
+            (unsigned long long)stats->bytes_allocated, (unsigned long long)stats->bytes_freed,
+            (unsigned long long)(stats->bytes_allocated - stats->bytes_freed));
+    fprintf(fp, ",\"classes\":[");
+    bool first = true;
+    for (uint32_t i = 0; i < HEAP_STATS_CLASSES; i++) {
+        if (stats->class_allocs[i] == 0) {
+            continue;
+        }
+        uint64_t size = heap_stats_class_size(i);
+        fprintf(fp, "%s{\"size\":", first ? "" : ",");
+        if (size == UINT64_MAX) {
+            fprintf(fp, "null");
+        } else {
+            fprintf(fp, "%llu", (unsigned long long)size);
+        }
+        fprintf(fp, ",\"allocs\":%llu,\"frees\":%llu,\"active\":%llu}", (unsigned long long)stats->class_allocs[i],
+                (unsigned long long)stats->class_frees[i],
+                (unsigned long long)(stats->class_allocs[i] - stats->class_frees[i]));
+        first = false;
+    }
+    fprintf(fp, "]");
+    if (lifetimes->sampled != 0) {
+        fprintf(fp, ",\"lifetimes\":{\"dropped\":%llu,\"classes\":[", (unsigned long long)lifetimes->dropped);
+        first = true;
+        for (uint32_t i = 0; i < HEAP_STATS_CLASSES; i++) {
+            uint32_t last = HEAP_LIFETIME_BUCKETS;
+            while (last > 0 && lifetimes->counts[i][last - 1] == 0) {
+                last--;
+            }
+            if (last == 0) {
+                continue;
+            }
+            uint64_t size = heap_stats_class_size(i);
+            fprintf(fp, "%s{\"size\":", first ? "" : ",");
+            if (size == UINT64_MAX) {
+                fprintf(fp, "null");
+            } else {
+                fprintf(fp, "%llu", (unsigned long long)size);
+            }
+            fprintf(fp, ",\"sum_ns\":%llu,\"buckets\":[", (unsigned long long)lifetimes->sum_ns[i]);
+            for (uint32_t b = 0; b < last; b++) {
+                fprintf(fp, "%s%llu", b == 0 ? "" : ",", (unsigned long long)lifetimes->counts[i][b]);
+            }
+            fprintf(fp, "]}");
+            first = false;
+        }
+        fprintf(fp, "]}");
+    }
+    if (region != NULL) {
+        fprintf(fp, ",\"grows\":%llu,\"failures\":%llu,\"trims\":%llu,\"bytes_trimmed\":%llu",
+                (unsigned long long)atomic_load_explicit(&region->grows, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&region->failures, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&region->trims, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&region->bytes_trimmed, memory_order_relaxed));
+    }
+    fprintf(fp, "}\n");
+}
+
+/**
+ * @brief Writes the allocator's metrics in Prometheus text or JSON format.
+ *
+ * Safe to call from any thread at any time: only the sharded counters and the
+ * telemetry totals are read.
+ *
+ * @param fp The stream to write to.
+ * @param format The output format.
+ * @return 0 on success, or -1 if writing failed.
+ */
+int heap_metrics_write(FILE *fp, enum heap_metrics_format_t format) {
+    struct heapstats_t stats;
+    struct heaplifetimes_t lifetimes;
+    heap_stats(&stats);
+    heap_lifetimes(&lifetimes);
+    const struct heaptelemetry_t *region = atomic_load_explicit(&heap_telemetry.region, memory_order_acquire);
+    if (format == HEAP_METRICS_JSON) {
+        heap_metrics_json(fp, &stats, &lifetimes, region);
+    } else {
+        heap_metrics_prometheus(fp, &stats, &lifetimes, region);
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+static bool heap_exporter_send(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the client's request, if any, and answers it.
+ */
+static void heap_exporter_serve(struct heapexporter_t *exporter, int client) {
+    char request[512] = "";
+    struct pollfd pfd = { .fd = client, .events = POLLIN };
+    if (poll(&pfd, 1, HEAP_EXPORTER_REQUEST_MS) > 0) {
+        ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+        request[n > 0 ? n : 0] = '\0';
+    }
+    bool http = strncmp(request, "GET ", 4) == 0;
+    enum heap_metrics_format_t format = exporter->format;
+    if (http) {
+        format = strncmp(request + 4, "/json", 5) == 0 ? HEAP_METRICS_JSON : HEAP_METRICS_PROMETHEUS;
+    } else if (strncmp(request, "json", 4) == 0) {
+        format = HEAP_METRICS_JSON;
+    } else if (strncmp(request, "prometheus", 10) == 0) {
+        format = HEAP_METRICS_PROMETHEUS;
+    }
+
+    char *body = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&body, &len);
+    if (fp == NULL) {
+        return;
+    }
+    int failed = heap_metrics_write(fp, format);
+    if (fclose(fp) != 0 || failed) {
+        free(body);
+        return;
+    }
+    if (http) {
+        char header[256];
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                         format == HEAP_METRICS_JSON ? "application/json" : "text/plain; version=0.0.4", len);
+        if (!heap_exporter_send(client, header, (size_t)n)) {
+            free(body);
+            return;
+        }
+    }
+    heap_exporter_send(client, body, len);
+    free(body);
+}
+
+static void *heap_exporter_main(void *arg) {
+    struct heapexporter_t *exporter = arg;
+    struct pollfd pfd = { .fd = exporter->fd, .events = POLLIN };
+    while (!atomic_load_explicit(&exporter->stop, memory_order_relaxed)) {
+        if (poll(&pfd, 1, HEAP_EXPORTER_POLL_MS) <= 0) {
+            continue;
+        }
+        int client = accept(exporter->fd, NULL, NULL);
+        if (client >= 0) {
+            struct timeval timeout = {
+                .tv_sec = HEAP_EXPORTER_SEND_MS / 1000,
+                .tv_usec = HEAP_EXPORTER_SEND_MS % 1000 * 1000,
+            };
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            heap_exporter_serve(exporter, client);
+            close(client);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts serving metrics on a Unix domain socket.
+ *
+ * A stale socket left at `path` by an earlier run is replaced; any other file there
+ * makes the call fail.
+ *
+ * @param exporter Pointer to the heapexporter_t structure to be initialized.
+ * @param path The socket path.
+ * @param format Format sent to clients that do not ask for one.
+ * @return 0 on success, or -1 with errno set if the socket or the thread could not be
+ *         created.
+ */
+int heap_exporter_start(struct heapexporter_t *exporter, const char *path, enum heap_metrics_format_t format) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    exporter->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (exporter->fd < 0) {
+        return -1;
+    }
+    if (bind(exporter->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(exporter->fd, HEAP_EXPORTER_BACKLOG) != 0) {
+        int error = errno;
+        close(exporter->fd);
+        errno = error;
+        return -1;
+    }
+    exporter->format = format;
+    strcpy(exporter->path, path);
+    atomic_init(&exporter->stop, false);
+    int error = pthread_create(&exporter->thread, NULL, heap_exporter_main, exporter);
+    if (error != 0) {
+        close(exporter->fd);
+        unlink(path);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the exporter thread and removes its socket.
+ *
+ * @param exporter Pointer to the running exporter.
+ */
+void heap_exporter_stop(struct heapexporter_t *exporter) {
+    atomic_store_explicit(&exporter->stop, true, memory_order_relaxed);
+    pthread_join(exporter->thread, NULL);
+    close(exporter->fd);
+    unlink(exporter->path);
+}
+
+/**
+ * @brief The exporter started from MYALLOC_CONF, if any.
+ */
+static struct {
+    struct heapexporter_t exporter;
+    bool running;
+} heap_exporter_auto;
+
+/**
+ * @brief Starts the exporter named by `exporter.path` in MYALLOC_CONF.
+ *
+ * @param path The socket path; each `%p` is replaced by the process id.
+ * @return 0 on success, or -1 with errno set.
+ */
+static int heap_exporter_autostart(const char *path) {
+    if (heap_exporter_auto.running) {
+        errno = EBUSY;
+        return -1;
+    }
+    char expanded[sizeof(heap_exporter_auto.exporter.path)];
+    size_t len = 0;
+    for (; *path != '\0'; path++) {
+        int n;
+        if (path[0] == '%' && path[1] == 'p') {
+            n = snprintf(expanded + len, sizeof(expanded) - len, "%ld", (long)getpid());
+            path++;
+        } else {
+            n = snprintf(expanded + len, sizeof(expanded) - len, "%c", *path);
+        }
+        if (n < 0 || (size_t)n >= sizeof(expanded) - len) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        len += (size_t)n;
+    }
+    expanded[len] = '\0';
+    if (heap_exporter_start(&heap_exporter_auto.exporter, expanded, HEAP_METRICS_PROMETHEUS) != 0) {
+        return -1;
+    }
+    heap_exporter_auto.running = true;
+    return 0;
+}
+
+/**
+ * @brief Stops the exporter started from MYALLOC_CONF at exit, removing its socket.
+ */
+__attribute__((destructor)) static void heap_exporter_autostop(void) {
+    if (heap_exporter_auto.running) {
+        heap_exporter_stop(&heap_exporter_auto.exporter);
+        heap_exporter_auto.running = false;
+    }
+}
+
+#ifndef HEAP_NO_MAIN
+/**
+ * @brief Main function to demonstrate the heap allocator.
+ *
+ * Define HEAP_NO_MAIN to build this file into another program, such as the benchmarks.
  */
 int main() {
     // Allocate a block of memory for the heap
@@ -280,3 +5231,4 @@ int main() {
 
     return 0;
 }
+#endif
@@ -0,0 +1,63 @@
+#define HEAP_NO_MAIN
+#include "../src/main.c"
+
+#include <assert.h>
+
+
+/**
+ * @file bulk_test.c
+ * @brief Checks that heap_calloc() and heap_realloc() keep data through the bulk kernels.
+ *
+ * @details
+ * Grows multi-megabyte blocks with heap_realloc(), which copies them with heap_bulk_copy()
+ * using the non-temporal kernel, then again with the worker pool splitting the copy and
+ * the zeroing, and checks every byte. Also checks that heap_calloc() rejects element
+ * counts whose total size overflows.
+ *
+ *     cc -O2 -pthread tests/bulk_test.c -o bulk_test
+ *     ./bulk_test
+ */
+#define TEST_SIZE (8u << 20)
+
+/**
+ * @brief Returns the test pattern byte for offset `i`, which differs between pages.
+ */
+static inline uint8_t test_pattern(size_t i) {
+    return (uint8_t)(i * 31 + (i >> 12) + 7);
+}
+
+/**
+ * @brief Grows a filled block to twice its size and checks the old contents.
+ */
+static void test_realloc(size_t size) {
+    uint8_t *ptr = heap_calloc(1, size);
+    assert(ptr != NULL);
+    for (size_t i = 0; i < size; i++) {
+        assert(ptr[i] == 0);
+        ptr[i] = test_pattern(i);
+    }
+    ptr = heap_realloc(ptr, 2 * size);
+    assert(ptr != NULL);
+    for (size_t i = 0; i < size; i++) {
+        assert(ptr[i] == test_pattern(i));
+    }
+    free(ptr);
+}
+
+int main(void) {
+    test_realloc(TEST_SIZE);
+    test_realloc(4096);
+
+    size_t parallel_min = 1u << 20;
+    assert(heap_ctl("opt.parallel_min", NULL, NULL, &parallel_min, sizeof(parallel_min)) == 0);
+    assert(heap_parallel_start(3) == 0);
+    test_realloc(TEST_SIZE + 12345);
+    heap_parallel_stop();
+
+    errno = 0;
+    assert(heap_calloc(SIZE_MAX / 2, 3) == NULL && errno == ENOMEM);
+    errno = 0;
+    assert(heap_calloc((size_t)1 << 40, (size_t)1 << 40) == NULL && errno == ENOMEM);
+    printf("bulk_test: ok\n");
+    return 0;
+}
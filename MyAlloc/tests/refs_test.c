@@ -0,0 +1,93 @@
+#define HEAP_NO_MAIN
+#include "../src/main.c"
+
+#include <assert.h>
+
+
+/**
+ * @file refs_test.c
+ * @brief Shares blocks between threads with heap_retain() and heap_release().
+ *
+ * @details
+ * The owning thread allocates blocks, retains each once per consumer and publishes it.
+ * Every consumer reads and releases every block while the owner keeps allocating and
+ * freeing, which drains the released blocks concurrently with the consumers queuing
+ * them. Once all consumers are done, heap_drain() must leave the heap fully free, with
+ * no shared block left in the side table. Also checks that heap_trim() drains a heap
+ * that went idle.
+ *
+ *     cc -O2 -pthread tests/refs_test.c -o refs_test
+ *     ./refs_test
+ */
+#define TEST_THREADS 8
+#define TEST_BLOCKS 4000
+#define TEST_HEAP_SIZE (4u << 20)
+
+static struct heapinfo_t test_heap;
+static void *_Atomic test_blocks[TEST_BLOCKS];
+
+/**
+ * @brief Reads and releases every published block, in order.
+ */
+static void *test_consumer(void *arg) {
+    (void)arg;
+    for (int i = 0; i < TEST_BLOCKS; i++) {
+        uint32_t *block;
+        while ((block = atomic_load_explicit(&test_blocks[i], memory_order_acquire)) == NULL) {
+            sched_yield();
+        }
+        assert(block[0] == (uint32_t)i);
+        heap_release(&test_heap, block);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Checks that the heap is a single free chunk and no block is shared.
+ */
+static void test_check_empty(void) {
+    assert(!test_heap.start->inuse && test_heap.start->next == NULL);
+    assert(atomic_load_explicit(&test_heap.deferred, memory_order_relaxed) == NULL);
+    for (int i = 0; i < HEAP_REFS_STRIPES; i++) {
+        assert(atomic_load_explicit(&heap_refs[i].used, memory_order_relaxed) == 0);
+    }
+}
+
+int main(void) {
+    static uint8_t memory[TEST_HEAP_SIZE] __attribute__((aligned(16)));
+    heap_init(&test_heap, memory, sizeof(memory));
+
+    pthread_t threads[TEST_THREADS];
+    for (int t = 0; t < TEST_THREADS; t++) {
+        assert(pthread_create(&threads[t], NULL, test_consumer, NULL) == 0);
+    }
+    for (int i = 0; i < TEST_BLOCKS; i++) {
+        uint32_t *block = heap_alloc(&test_heap, 16 + (uint32_t)(i % 7) * 24);
+        assert(block != NULL);
+        block[0] = (uint32_t)i;
+        // One reference per consumer: the allocation's own plus TEST_THREADS - 1
+        for (int t = 1; t < TEST_THREADS; t++) {
+            assert(heap_retain(block) == block);
+        }
+        atomic_store_explicit(&test_blocks[i], block, memory_order_release);
+        heap_free(&test_heap, heap_alloc(&test_heap, 64));
+    }
+    for (int t = 0; t < TEST_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    heap_drain(&test_heap);
+    test_check_empty();
+
+    // A block released on an idle heap is freed by heap_trim()
+    void *block = heap_alloc(&test_heap, 100);
+    heap_retain(block);
+    heap_release(&test_heap, block);
+    assert(test_heap.start->inuse);
+    heap_release(&test_heap, block);
+    assert(test_heap.start->inuse);
+    heap_trim(&test_heap, 0);
+    test_check_empty();
+
+    printf("refs_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,205 @@
+#define HEAP_NO_MAIN
+#include "../src/main.c"
+
+#include <assert.h>
+#include <fcntl.h>
+
+
+/**
+ * @file uring_test.c
+ * @brief Reads a file through io_uring into buffers of a heapuring_t pool.
+ *
+ * @details
+ * Checks a READ_FIXED into a fixed buffer taken with heap_uring_get(), then a read with
+ * IOSQE_BUFFER_SELECT into a buffer handed to the kernel with heap_uring_provide(), and
+ * the bounds and double-put checks of heap_uring_put(). Exits successfully without
+ * running the io_uring part where the kernel or sandbox has no io_uring.
+ *
+ *     cc -O2 -pthread tests/uring_test.c -o uring_test
+ *     ./uring_test
+ */
+#define TEST_BUF_SIZE 4096
+#define TEST_BUFFERS 8
+#define TEST_BGID 7
+
+/**
+ * @struct testring_t
+ * @brief The mapped submission and completion rings of a minimal io_uring instance.
+ */
+struct testring_t {
+    int fd;
+    struct io_uring_params params;
+    uint8_t *sq;
+    uint8_t *cq;
+    size_t sq_length;
+    size_t cq_length;
+    struct io_uring_sqe *sqes;
+};
+
+/**
+ * @brief Creates an io_uring instance and maps its rings.
+ *
+ * @return 0 on success, -1 if io_uring is unavailable.
+ */
+static int test_ring_init(struct testring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, 4, &ring->params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    struct io_uring_params *p = &ring->params;
+    ring->sq_length = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+    ring->cq_length = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_length = ring->cq_length = ring->sq_length > ring->cq_length ? ring->sq_length : ring->cq_length;
+    }
+    ring->sq = mmap(NULL, ring->sq_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    IORING_OFF_SQ_RING);
+    ring->cq = (p->features & IORING_FEAT_SINGLE_MMAP)
+                   ? ring->sq
+                   : mmap(NULL, ring->cq_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                          IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, p->sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq == MAP_FAILED || ring->cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Submits one request and waits for its completion.
+ *
+ * @param res Receives the result of the request.
+ * @param flags Receives the completion flags.
+ */
+static void test_ring_run(struct testring_t *ring, const struct io_uring_sqe *request, int32_t *res,
+                          uint32_t *flags) {
+    struct io_uring_params *p = &ring->params;
+    _Atomic uint32_t *sq_tail = (_Atomic uint32_t *)(ring->sq + p->sq_off.tail);
+    uint32_t *sq_array = (uint32_t *)(ring->sq + p->sq_off.array);
+    uint32_t tail = atomic_load_explicit(sq_tail, memory_order_relaxed);
+    uint32_t slot = tail & *(uint32_t *)(ring->sq + p->sq_off.ring_mask);
+    ring->sqes[slot] = *request;
+    sq_array[slot] = slot;
+    atomic_store_explicit(sq_tail, tail + 1, memory_order_release);
+    long ret = syscall(__NR_io_uring_enter, ring->fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    assert(ret == 1);
+
+    _Atomic uint32_t *cq_head = (_Atomic uint32_t *)(ring->cq + p->cq_off.head);
+    _Atomic uint32_t *cq_tail = (_Atomic uint32_t *)(ring->cq + p->cq_off.tail);
+    uint32_t head = atomic_load_explicit(cq_head, memory_order_relaxed);
+    assert(atomic_load_explicit(cq_tail, memory_order_acquire) != head);
+    struct io_uring_cqe *cqes = (struct io_uring_cqe *)(ring->cq + p->cq_off.cqes);
+    struct io_uring_cqe *cqe = &cqes[head & *(uint32_t *)(ring->cq + p->cq_off.ring_mask)];
+    *res = cqe->res;
+    *flags = cqe->flags;
+    atomic_store_explicit(cq_head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Unmaps the rings and closes the instance.
+ */
+static void test_ring_destroy(struct testring_t *ring) {
+    munmap(ring->sqes, ring->params.sq_entries * sizeof(struct io_uring_sqe));
+    if (ring->cq != ring->sq) {
+        munmap(ring->cq, ring->cq_length);
+    }
+    munmap(ring->sq, ring->sq_length);
+    close(ring->fd);
+}
+
+/**
+ * @brief Checks that heap_uring_put() rejects foreign and repeated indices.
+ */
+static void test_put_checks(void) {
+    struct heapuring_t pool;
+    assert(heap_uring_init(&pool, -1, TEST_BUF_SIZE, TEST_BUFFERS, TEST_BGID) == 0);
+    assert(heap_uring_put(&pool, 0) == -1);
+    assert(heap_uring_put(&pool, TEST_BUFFERS) == -1);
+    uint16_t index;
+    for (int i = 0; i < TEST_BUFFERS; i++) {
+        assert(heap_uring_get(&pool, &index) != NULL);
+    }
+    assert(heap_uring_get(&pool, &index) == NULL);
+    assert(heap_uring_put(&pool, 3) == 0);
+    assert(heap_uring_put(&pool, 3) == -1);
+    assert(heap_uring_put(&pool, UINT16_MAX) == -1);
+    assert(pool.nfree == 1);
+    heap_uring_destroy(&pool);
+}
+
+int main(void) {
+    test_put_checks();
+
+    struct testring_t ring;
+    if (test_ring_init(&ring) != 0) {
+        printf("uring_test: io_uring unavailable (%s), skipped\n", strerror(errno));
+        return 0;
+    }
+    struct heapuring_t pool;
+    assert(heap_uring_init(&pool, ring.fd, TEST_BUF_SIZE, TEST_BUFFERS, TEST_BGID) == 0);
+    if (!pool.fixed || !pool.provided) {
+        printf("uring_test: fixed or provided buffers unsupported, skipped\n");
+        heap_uring_destroy(&pool);
+        test_ring_destroy(&ring);
+        return 0;
+    }
+
+    char path[] = "/tmp/uring_testXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    char data[2 * TEST_BUF_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)(i * 7 + 1);
+    }
+    assert(write(fd, data, sizeof(data)) == (ssize_t)sizeof(data));
+
+    // READ_FIXED into a buffer taken from the pool
+    uint16_t index;
+    uint8_t *buf = heap_uring_get(&pool, &index);
+    assert(buf != NULL);
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ_FIXED;
+    sqe.fd = fd;
+    sqe.addr = (uintptr_t)buf;
+    sqe.len = TEST_BUF_SIZE;
+    sqe.off = 0;
+    sqe.buf_index = index;
+    int32_t res;
+    uint32_t flags;
+    test_ring_run(&ring, &sqe, &res, &flags);
+    assert(res == TEST_BUF_SIZE);
+    assert(memcmp(buf, data, TEST_BUF_SIZE) == 0);
+    assert(heap_uring_put(&pool, index) == 0);
+
+    // A read that lets the kernel pick a provided buffer
+    buf = heap_uring_get(&pool, &index);
+    assert(buf != NULL);
+    assert(heap_uring_provide(&pool, index) == 0);
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.len = TEST_BUF_SIZE;
+    sqe.off = TEST_BUF_SIZE;
+    sqe.buf_group = TEST_BGID;
+    test_ring_run(&ring, &sqe, &res, &flags);
+    assert(res == TEST_BUF_SIZE);
+    assert(flags & IORING_CQE_F_BUFFER);
+    uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+    assert(bid == index);
+    assert(memcmp(heap_uring_buf(&pool, bid), data + TEST_BUF_SIZE, TEST_BUF_SIZE) == 0);
+    assert(heap_uring_put(&pool, bid) == 0);
+    assert(heap_uring_put(&pool, bid) == -1);
+    assert(pool.nfree == TEST_BUFFERS);
+
+    close(fd);
+    heap_uring_destroy(&pool);
+    test_ring_destroy(&ring);
+    printf("uring_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/**
+ * @file sizeclass_tune.c
+ * @brief Computes a size-class set fitted to an observed allocation size distribution.
+ *
+ * @details
+ * The tool reads an allocation trace or a size histogram and chooses at most
+ * `-k` size classes so that rounding every observed request up to its class
+ * wastes as few bytes as possible. The result is printed as a header that
+ * main.c picks up at compile time:
+ *
+ *     sizeclass_tune -k 8 trace.txt > sizeclasses.h
+ *     cc -include sizeclasses.h main.c
+ *
+ * Accepted input lines (one per line, '#' starts a comment):
+ * - `a <size>` or `alloc <size>`: one allocation event from a trace.
+ * - `f ...` or `free ...`: free events, ignored.
+ * - `<size> <count>`: one histogram bucket.
+ * - `<size>`: a single allocation.
+ *
+ * ALIGNMENT must match the value used by main.c, since requests are aligned
+ * before they are rounded to a class.
+ */
+#define ALIGNMENT 8
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+
+#define DEFAULT_CLASSES 16
+
+/**
+ * @struct sizebin_t
+ * @brief One distinct (aligned) request size and how often it was seen.
+ *
+ * @var sizebin_t::size
+ * Aligned request size in bytes.
+ *
+ * @var sizebin_t::count
+ * Number of requests of this size.
+ */
+struct sizebin_t {
+    uint32_t size;
+    uint64_t count;
+};
+
+static int sizebin_cmp(const void *a, const void *b) {
+    const struct sizebin_t *x = a;
+    const struct sizebin_t *y = b;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+/**
+ * @brief Parses one input line into a size and a count.
+ *
+ * @param line The input line.
+ * @param size Receives the request size.
+ * @param count Receives the number of requests the line stands for.
+ * @return 1 if the line describes allocations, 0 if it should be skipped.
+ */
+static int parse_line(char *line, uint64_t *size, uint64_t *count) {
+    char *hash = strchr(line, '#');
+    if (hash != NULL) {
+        *hash = '\0';
+    }
+    char *tok = strtok(line, " \t\r\n,");
+    if (tok == NULL) {
+        return 0;
+    }
+    if (strcmp(tok, "f") == 0 || strcmp(tok, "free") == 0) {
+        return 0;
+    }
+    if (strcmp(tok, "a") == 0 || strcmp(tok, "alloc") == 0) {
+        tok = strtok(NULL, " \t\r\n,");
+        if (tok == NULL) {
+            return 0;
+        }
+        *size = strtoull(tok, NULL, 0);
+        *count = 1;
+        return *size > 0;
+    }
+    *size = strtoull(tok, NULL, 0);
+    tok = strtok(NULL, " \t\r\n,");
+    *count = tok != NULL ? strtoull(tok, NULL, 0) : 1;
+    return *size > 0 && *count > 0;
+}
+
+/**
+ * @brief Reads the input and returns the sorted, merged histogram.
+ *
+ * @param in The stream to read from.
+ * @param nbins Receives the number of distinct sizes.
+ * @return An array of `*nbins` bins sorted by size, or NULL on error.
+ */
+static struct sizebin_t *read_histogram(FILE *in, size_t *nbins) {
+    size_t n = 0, cap = 1024;
+    struct sizebin_t *bins = malloc(cap * sizeof(*bins));
+    char line[256];
+    uint64_t size, count;
+
+    if (bins == NULL) {
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (!parse_line(line, &size, &count) || size > UINT32_MAX - ALIGNMENT) {
+            continue;
+        }
+        if (n == cap) {
+            struct sizebin_t *grown = realloc(bins, 2 * cap * sizeof(*bins));
+            if (grown == NULL) {
+                free(bins);
+                return NULL;
+            }
+            bins = grown;
+            cap *= 2;
+        }
+        bins[n].size = ALIGN((uint32_t)size);
+        bins[n].count = count;
+        n++;
+    }
+
+    qsort(bins, n, sizeof(*bins), sizebin_cmp);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m > 0 && bins[m - 1].size == bins[i].size) {
+            bins[m - 1].count += bins[i].count;
+        } else {
+            bins[m++] = bins[i];
+        }
+    }
+    *nbins = m;
+    return bins;
+}
+
+/**
+ * @brief Chooses at most `k` classes minimizing the total rounding waste.
+ *
+ * Classes are always placed on observed sizes and the largest observed size
+ * is always a class. With prefix sums, the waste of serving bins i..j from
+ * class bins[j].size is constant time, so the dynamic program runs in
+ * O(k * m^2) for m distinct sizes.
+ *
+ * @param bins The sorted histogram.
+ * @param m Number of bins.
+ * @param k Maximum number of classes.
+ * @param classes Receives the chosen class sizes in increasing order.
+ * @param waste Receives the total number of wasted bytes.
+ * @return The number of classes written to `classes`.
+ */
+static size_t choose_classes(const struct sizebin_t *bins, size_t m, size_t k,
+                             uint32_t *classes, uint64_t *waste) {
+    if (k > m) {
+        k = m;
+    }
+    uint64_t *cnt = calloc(m + 1, sizeof(uint64_t));
+    uint64_t *sum = calloc(m + 1, sizeof(uint64_t));
+    uint64_t *cost = malloc(2 * m * sizeof(uint64_t));
+    uint32_t *cut = malloc(k * m * sizeof(uint32_t));
+    if (cnt == NULL || sum == NULL || cost == NULL || cut == NULL) {
+        free(cnt); free(sum); free(cost); free(cut);
+        return 0;
+    }
+    for (size_t i = 0; i < m; i++) {
+        cnt[i + 1] = cnt[i] + bins[i].count;
+        sum[i + 1] = sum[i] + bins[i].count * bins[i].size;
+    }
+#define WASTE(i, j) ((uint64_t)bins[j].size * (cnt[(j) + 1] - cnt[i]) - (sum[(j) + 1] - sum[i]))
+
+    // prev[j]: best waste covering bins 0..j with the current number of classes
+    uint64_t *prev = cost, *curr = cost + m;
+    for (size_t j = 0; j < m; j++) {
+        prev[j] = WASTE(0, j);
+        cut[j] = 0;
+    }
+    for (size_t c = 1; c < k; c++) {
+        for (size_t j = 0; j < m; j++) {
+            uint64_t best = WASTE(0, j);
+            uint32_t best_i = 0;
+            for (size_t i = 1; i <= j; i++) {
+                uint64_t w = prev[i - 1] + WASTE(i, j);
+                if (w < best) {
+                    best = w;
+                    best_i = (uint32_t)i;
+                }
+            }
+            curr[j] = best;
+            cut[c * m + j] = best_i;
+        }
+        uint64_t *tmp = prev; prev = curr; curr = tmp;
+    }
+#undef WASTE
+    *waste = prev[m - 1];
+
+    // Walk the cuts back from the largest size
+    size_t n = 0;
+    size_t j = m;
+    for (size_t c = k; c > 0 && j > 0; c--) {
+        classes[n++] = bins[j - 1].size;
+        j = cut[(c - 1) * m + (j - 1)];
+    }
+    for (size_t a = 0, b = n - 1; a < b; a++, b--) {
+        uint32_t tmp = classes[a]; classes[a] = classes[b]; classes[b] = tmp;
+    }
+
+    free(cnt); free(sum); free(cost); free(cut);
+    return n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-k classes] [trace-or-histogram]\n", prog);
+}
+
+/**
+ * @brief Reads a trace or histogram and prints a size-class header for main.c.
+ */
+int main(int argc, char **argv) {
+    size_t k = DEFAULT_CLASSES;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:h")) != -1) {
+        switch (opt) {
+        case 'k':
+            k = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (k == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE *in = stdin;
+    if (optind < argc) {
+        in = fopen(argv[optind], "r");
+        if (in == NULL) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+
+    size_t m = 0;
+    struct sizebin_t *bins = read_histogram(in, &m);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (bins == NULL) {
+        perror("read");
+        return 1;
+    }
+    if (m == 0) {
+        fprintf(stderr, "no allocations found in input\n");
+        free(bins);
+        return 1;
+    }
+
+    uint32_t *classes = malloc((k < m ? k : m) * sizeof(uint32_t));
+    uint64_t waste = 0;
+    size_t n = classes != NULL ? choose_classes(bins, m, k, classes, &waste) : 0;
+    if (n == 0) {
+        perror("malloc");
+        free(bins);
+        free(classes);
+        return 1;
+    }
+
+    uint64_t requests = 0, bytes = 0;
+    for (size_t i = 0; i < m; i++) {
+        requests += bins[i].count;
+        bytes += bins[i].count * bins[i].size;
+    }
+
+    printf("/* Generated by sizeclass_tune: %zu classes from %llu requests,\n", n,
+           (unsigned long long)requests);
+    printf(" * internal fragmentation %llu of %llu bytes (%.2f%%). */\n",
+           (unsigned long long)waste, (unsigned long long)(bytes + waste),
+           bytes + waste > 0 ? 100.0 * (double)waste / (double)(bytes + waste) : 0.0);
+    printf("#define HEAP_SIZE_CLASSES");
+    for (size_t i = 0; i < n; i++) {
+        printf("%s%u", i == 0 ? " " : ", ", classes[i]);
+    }
+    printf("\n");
+
+    free(bins);
+    free(classes);
+    return 0;
+}
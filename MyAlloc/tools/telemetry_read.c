@@ -0,0 +1,200 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+
+/**
+ * @file telemetry_read.c
+ * @brief Attaches read-only to a process's allocator telemetry and prints it.
+ *
+ * @details
+ * The region is the one created by heap_telemetry_open() in main.c, found either as
+ * /dev/shm/<name> or, for a memfd, as /proc/<pid>/fd/<fd>:
+ *
+ *     telemetry_read /dev/shm/myalloc       # counters and recent events, once
+ *     telemetry_read -f -i 500 /dev/shm/myalloc   # keep printing new events
+ *
+ * The process being watched is never stopped or signalled; the region is only mapped
+ * read-only. The structures below must match the layout documented in main.c.
+ */
+#define HEAP_TELEMETRY_MAGIC 0x314f4c4c4159594dull
+#define HEAP_TELEMETRY_VERSION 1
+
+#define HEAP_EVENT_GROW 1
+#define HEAP_EVENT_FAIL 2
+#define HEAP_EVENT_TRIM 3
+
+#define DEFAULT_INTERVAL_MS 1000
+
+struct heapevent_t {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t time_ns;
+    _Atomic uint32_t type;
+    _Atomic uint32_t tid;
+    _Atomic uint64_t heap;
+    _Atomic uint64_t size;
+    _Atomic uint64_t addr;
+};
+
+struct heaptelemetry_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t event_size;
+    uint32_t capacity;
+    uint64_t pid;
+    _Alignas(64) _Atomic uint64_t seq;
+    _Atomic uint64_t time_ns;
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    _Atomic uint64_t bytes_allocated;
+    _Atomic uint64_t bytes_freed;
+    _Alignas(64) _Atomic uint64_t grows;
+    _Atomic uint64_t failures;
+    _Atomic uint64_t trims;
+    _Atomic uint64_t bytes_trimmed;
+    _Alignas(64) _Atomic uint64_t head;
+};
+
+static const char *event_name(uint32_t type) {
+    switch (type) {
+    case HEAP_EVENT_GROW:
+        return "grow";
+    case HEAP_EVENT_FAIL:
+        return "fail";
+    case HEAP_EVENT_TRIM:
+        return "trim";
+    default:
+        return "?";
+    }
+}
+
+/**
+ * @brief Prints a consistent copy of the counters.
+ */
+static void print_counters(const struct heaptelemetry_t *region) {
+    uint64_t seq, time_ns, allocs, frees, allocated, freed;
+    do {
+        seq = atomic_load_explicit(&region->seq, memory_order_acquire);
+        time_ns = atomic_load_explicit(&region->time_ns, memory_order_relaxed);
+        allocs = atomic_load_explicit(&region->allocs, memory_order_relaxed);
+        frees = atomic_load_explicit(&region->frees, memory_order_relaxed);
+        allocated = atomic_load_explicit(&region->bytes_allocated, memory_order_relaxed);
+        freed = atomic_load_explicit(&region->bytes_freed, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) != 0 || atomic_load_explicit(&region->seq, memory_order_relaxed) != seq);
+
+    printf("pid %llu at %llu.%09llu\n", (unsigned long long)region->pid,
+           (unsigned long long)(time_ns / 1000000000u), (unsigned long long)(time_ns % 1000000000u));
+    printf("allocs %llu frees %llu active %llu bytes\n", (unsigned long long)allocs,
+           (unsigned long long)frees, (unsigned long long)(allocated - freed));
+    printf("grows %llu failures %llu trims %llu (%llu bytes)\n",
+           (unsigned long long)atomic_load_explicit(&region->grows, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&region->failures, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&region->trims, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&region->bytes_trimmed, memory_order_relaxed));
+}
+
+/**
+ * @brief Prints the events from index `from` up to the current head.
+ *
+ * @return The index to continue from.
+ */
+static uint64_t print_events(const struct heaptelemetry_t *region, uint64_t from) {
+    const uint8_t *ring = (const uint8_t *)region + region->header_size;
+    uint64_t head = atomic_load_explicit(&region->head, memory_order_acquire);
+    if (head - from > region->capacity) {
+        printf("(%llu events lost)\n", (unsigned long long)(head - region->capacity - from));
+        from = head - region->capacity;
+    }
+    for (uint64_t i = from; i < head; i++) {
+        const struct heapevent_t *slot = (const void *)(ring + (i & (region->capacity - 1)) * region->event_size);
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        uint64_t time_ns = atomic_load_explicit(&slot->time_ns, memory_order_relaxed);
+        uint32_t type = atomic_load_explicit(&slot->type, memory_order_relaxed);
+        uint32_t tid = atomic_load_explicit(&slot->tid, memory_order_relaxed);
+        uint64_t heap = atomic_load_explicit(&slot->heap, memory_order_relaxed);
+        uint64_t size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+        uint64_t addr = atomic_load_explicit(&slot->addr, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (seq != 2 * i + 2 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+            continue; // Still being written, or already overwritten
+        }
+        printf("%llu.%09llu tid %u %s heap 0x%llx size %llu addr 0x%llx\n",
+               (unsigned long long)(time_ns / 1000000000u), (unsigned long long)(time_ns % 1000000000u),
+               tid, event_name(type), (unsigned long long)heap, (unsigned long long)size,
+               (unsigned long long)addr);
+    }
+    return head;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-f] [-i interval-ms] region\n", prog);
+}
+
+/**
+ * @brief Maps a telemetry region read-only and prints its counters and events.
+ */
+int main(int argc, char **argv) {
+    bool follow = false;
+    unsigned long interval = DEFAULT_INTERVAL_MS;
+    int opt;
+    while ((opt = getopt(argc, argv, "fi:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            follow = true;
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(struct heaptelemetry_t)) {
+        fprintf(stderr, "%s: too small for a telemetry region\n", argv[optind]);
+        return 1;
+    }
+    const struct heaptelemetry_t *region = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (region->magic != HEAP_TELEMETRY_MAGIC || region->version != HEAP_TELEMETRY_VERSION ||
+        region->event_size < sizeof(struct heapevent_t) || region->capacity == 0 ||
+        (region->capacity & (region->capacity - 1)) != 0 ||
+        region->header_size + (size_t)region->capacity * region->event_size > (size_t)st.st_size) {
+        fprintf(stderr, "%s: not a version %d telemetry region\n", argv[optind], HEAP_TELEMETRY_VERSION);
+        return 1;
+    }
+
+    print_counters(region);
+    uint64_t next = print_events(region, 0);
+    while (follow) {
+        usleep(interval * 1000);
+        print_counters(region);
+        next = print_events(region, next);
+        fflush(stdout);
+    }
+    return 0;
+}